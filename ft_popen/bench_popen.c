@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "ft_popen.h"
+
+// Benchmark: grows the heap step by step to each requested size, touching
+// every page so that it is resident, and at each step times ft_popen of
+// "true" with every backend: fork, posix_spawn and a zygote started before
+// the heap grew. Only the ft_popen call is timed; reaping is not. Each result
+// is one JSON object per line, or a CSV row with -c, with the resident size
+// read back from /proc/self/statm.
+// Usage: bench_popen [-c] [-n SPAWNS] [MB...]
+#define BENCH_STEP ((size_t)64 << 20)
+
+typedef enum backend {
+	B_FORK,
+	B_SPAWN,
+	B_ZYGOTE,
+	B_COUNT
+}	backend;
+
+static const char	*g_backends[B_COUNT] = {"fork", "spawn", "zygote"};
+
+typedef struct result {
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	total;
+	int			failed;
+}	result;
+
+static uint64_t	now_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+static size_t	resident_mb(void)
+{
+	FILE			*f;
+	unsigned long	size;
+	unsigned long	rss;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return (0);
+	rss = 0;
+	if (fscanf(f, "%lu %lu", &size, &rss) != 2)
+		rss = 0;
+	fclose(f);
+	return (rss * (size_t)sysconf(_SC_PAGESIZE) >> 20);
+}
+
+typedef struct heap {
+	char	**blocks;
+	size_t	n;
+	size_t	size;
+}	heap;
+
+static int	grow_to(heap *h, size_t want)
+{
+	char	**blocks;
+	size_t	n;
+
+	while (h->size < want)
+	{
+		n = want - h->size < BENCH_STEP ? want - h->size : BENCH_STEP;
+		blocks = realloc(h->blocks, (h->n + 1) * sizeof(*blocks));
+		if (!blocks)
+			return (0);
+		h->blocks = blocks;
+		h->blocks[h->n] = malloc(n);
+		if (!h->blocks[h->n])
+			return (0);
+		memset(h->blocks[h->n++], 1, n);
+		h->size += n;
+	}
+	return (1);
+}
+
+static void	release(heap *h)
+{
+	while (h->n)
+		free(h->blocks[--h->n]);
+	free(h->blocks);
+	h->blocks = NULL;
+	h->size = 0;
+}
+
+static void	bench_backend(backend b, int spawns, result *r)
+{
+	uint64_t	t;
+	int			fd;
+	int			i;
+
+	ft_popen_use_spawn(b == B_SPAWN);
+	memset(r, 0, sizeof(*r));
+	i = 0;
+	while (i++ < spawns)
+	{
+		t = now_ns();
+		fd = ft_popen("true", (char *const []){"true", NULL}, 'r');
+		t = now_ns() - t;
+		if (fd == -1)
+		{
+			r->failed++;
+			continue ;
+		}
+		close(fd);
+		wait(NULL);
+		if (!r->min || t < r->min)
+			r->min = t;
+		if (t > r->max)
+			r->max = t;
+		r->total += t;
+	}
+	ft_popen_use_spawn(0);
+}
+
+static void	report(int csv, size_t mb, backend b, int spawns, const result *r)
+{
+	const char	*fmt;
+	int			ok;
+
+	ok = spawns - r->failed;
+	if (csv)
+		fmt = "%zu,%zu,%s,%d,%llu,%llu,%llu,%d\n";
+	else
+		fmt = "{\"heap_mb\":%zu,\"rss_mb\":%zu,\"backend\":\"%s\","
+			"\"spawns\":%d,\"mean_ns\":%llu,\"min_ns\":%llu,\"max_ns\":%llu,"
+			"\"failed\":%d}\n";
+	printf(fmt, mb, resident_mb(), g_backends[b], spawns,
+		(unsigned long long)(ok ? r->total / ok : 0),
+		(unsigned long long)r->min, (unsigned long long)r->max, r->failed);
+	fflush(stdout);
+}
+
+typedef struct options {
+	char	**sizes;
+	int		nsizes;
+	int		spawns;
+	int		csv;
+}	options;
+
+// Runs backends first to last at every size, growing the heap from nothing.
+static int	sweep(const options *o, backend first, backend last)
+{
+	heap	h;
+	result	r;
+	size_t	mb;
+	int		i;
+	int		b;
+
+	memset(&h, 0, sizeof(h));
+	i = 0;
+	while (i < o->nsizes)
+	{
+		mb = strtoul(o->sizes[i++], NULL, 10);
+		if (!grow_to(&h, mb << 20))
+			return (release(&h), 0);
+		b = first;
+		while (b <= (int)last)
+		{
+			bench_backend((backend)b, o->spawns, &r);
+			report(o->csv, mb, (backend)b, o->spawns, &r);
+			b++;
+		}
+	}
+	release(&h);
+	return (1);
+}
+
+// The zygote is swept on its own, started before the heap grows; fork and
+// spawn are swept after it has stopped, as ft_popen would use it otherwise.
+int	main(int argc, char **argv)
+{
+	static char	*sizes[] = {"0", "128", "512", "2048"};
+	options		o;
+	int			i;
+
+	o.csv = 0;
+	o.spawns = 200;
+	i = 1;
+	while (i < argc && argv[i][0] == '-' && argv[i][1] && !argv[i][2])
+	{
+		if (argv[i][1] == 'c')
+			o.csv = 1;
+		else if (argv[i][1] == 'n' && i + 1 < argc)
+			o.spawns = atoi(argv[++i]);
+		else
+			return (fprintf(stderr, "usage: bench_popen [-c] [-n SPAWNS] "
+					"[MB...]\n"), 1);
+		i++;
+	}
+	o.sizes = i < argc ? argv + i : sizes;
+	o.nsizes = i < argc ? argc - i : (int)(sizeof(sizes) / sizeof(*sizes));
+	if (o.csv)
+		printf("heap_mb,rss_mb,backend,spawns,mean_ns,min_ns,max_ns,failed\n");
+	if (ft_popen_zygote_start() == 0)
+	{
+		i = sweep(&o, B_ZYGOTE, B_ZYGOTE);
+		ft_popen_zygote_stop();
+		if (!i)
+			return (fprintf(stderr, "bench_popen: out of memory\n"), 1);
+	}
+	if (!sweep(&o, B_FORK, B_SPAWN))
+		return (fprintf(stderr, "bench_popen: out of memory\n"), 1);
+	return (0);
+}
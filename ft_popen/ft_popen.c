@@ -1,25 +1,26 @@
 #include <unistd.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include "ft_popen.h"
 
-int	ft_popen(const char *file, char *const argv[], char type)
+static int	popen_fork(const char *file, char *const argv[], char type,
+				pid_t *pid)
 {
-	pid_t	pid;
 	int		fd[2];
 
-	if (!file || !argv || (type != 'r' && type != 'w'))
-		return (-1);
 	if (pipe(fd) == -1)
 		return (-1);
-	
-	pid = fork();
-	if (pid == -1)
+
+	*pid = fork();
+	if (*pid == -1)
 	{
 		close(fd[0]);
 		close(fd[1]);
 		return (-1);
 	}
-	if (pid == 0)
+	if (*pid == 0)
 	{
 		if (type == 'r')
 		{
@@ -51,3 +52,25 @@ int	ft_popen(const char *file, char *const argv[], char type)
 	}
 	return (0);
 }
+
+// A child whose pid cannot be recorded could never be closed by ft_pclose,
+// so it is killed and reaped here instead.
+int	ft_popen(const char *file, char *const argv[], char type)
+{
+	pid_t	pid;
+	int		fd;
+
+	if (!file || !argv || (type != 'r' && type != 'w'))
+		return (-1);
+	if (!ft_zygote_popen(file, argv, type, &fd, &pid)
+		&& !ft_spawn_popen(file, argv, type, &fd, &pid))
+		fd = popen_fork(file, argv, type, &pid);
+	if (fd != -1 && !ft_popen_track(fd, pid))
+	{
+		close(fd);
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return (-1);
+	}
+	return (fd);
+}
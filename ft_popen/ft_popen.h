@@ -0,0 +1,104 @@
+#ifndef FT_POPEN_H
+# define FT_POPEN_H
+
+// ft_popen launches file with argv and returns the read end of its stdout
+// ('r') or the write end of its stdin ('w'), -1 on error. The child is always
+// a child of the caller, to be reaped with ft_pclose, or wait() or waitpid().
+// Build the tests with: cc ft_popen.c ft_popen_*.c main.c -pthread
+// and the benchmark the same way from bench_popen.c, with -O2.
+
+# include <stdint.h>
+# include <sys/types.h>
+
+int	ft_popen(const char *file, char *const argv[], char type);
+
+// ft_popen_table.c
+// Every fd returned by ft_popen is recorded with its child's pid in a table
+// indexed by fd, which ft_popen_pid reads and ft_popen_track writes (0 if
+// memory ran out). ft_pclose closes fd and waits for exactly that child,
+// returning its wait status, or -1 if fd did not come from ft_popen. An fd
+// closed with close() keeps its entry until ft_popen returns that number
+// again. ft_popen_pidfd returns a new pidfd for the child, which polls
+// readable once it has exited: an event loop can watch it and then call
+// ft_pclose without blocking. -1 and errno if the kernel has no pidfds.
+int	ft_pclose(int fd);
+int	ft_popen_pidfd(int fd);
+pid_t	ft_popen_pid(int fd);
+int	ft_popen_track(int fd, pid_t pid);
+
+// ft_popen_rw.c
+// ft_popen in both directions: fd[0] reads the command's stdout and fd[1]
+// writes its stdin. fd[0] is the one to give ft_pclose, once fd[1] is closed.
+// Always forked by the caller, with both pipes close-on-exec so that no
+// other command inherits them. ft_popen_pump writes len bytes of in to fd[1]
+// while appending all of the output to out, both non-blocking under poll()
+// with the pipes enlarged, so no amount of data on either side can deadlock.
+// It closes fd[1] (setting it to -1) once the input is written or the
+// command stops reading, and returns at the end of the output: 0, or -1 and
+// errno. out must start zeroed or hold a malloc'd buffer to append to.
+// ft_popen_buf_reserve makes room for n more bytes in b, 0 if out of memory.
+typedef struct popen_buf {
+	char	*data;
+	size_t	len;
+	size_t	cap;
+}	popen_buf;
+
+int	ft_popen_rw(const char *file, char *const argv[], int fd[2]);
+int	ft_popen_pump(int fd[2], const void *in, size_t len, popen_buf *out);
+int	ft_popen_buf_reserve(popen_buf *b, size_t n);
+
+// ft_popen_runner.c
+// ft_popen_run runs n commands, at most max at a time (all at once if max is
+// 0), reading every stdout through one epoll loop so that a slow command
+// holds up none of the others. Each job's output is appended to out, which
+// must start zeroed; once it is reaped, status holds its wait status (-1 if
+// it could not be started) and ns the time from ft_popen until it exited. fd
+// and pidfd are used while it runs. Returns 0, or -1 and errno if the loop
+// itself failed, in which case the commands still running are killed.
+typedef struct popen_job {
+	const char	*file;
+	char *const	*argv;
+	popen_buf	out;
+	int			status;
+	uint64_t	ns;
+	int			fd;
+	int			pidfd;
+}	popen_job;
+
+int	ft_popen_run(popen_job *jobs, int n, int max);
+
+// ft_popen_zygote.c
+// A zygote is a process forked from the caller, ideally early while it is
+// still small, that forks the commands on its behalf: fork() copies the page
+// tables of the process that calls it, and the zygote's stay small however
+// large the caller grows. While it runs, ft_popen sends it each request over
+// a Unix socket and gets the pipe end back with SCM_RIGHTS. The commands are
+// created with CLONE_PARENT, so they are the caller's children all the same,
+// and start with the caller's standard streams, working directory and
+// environment as they are at the call. Processes forked from the caller,
+// requests whose file, arguments and environment exceed ZYGOTE_MSG_MAX bytes,
+// and every request on systems without CLONE_PARENT, fork for themselves.
+# define ZYGOTE_MSG_MAX (1 << 16)
+
+int	ft_popen_zygote_start(void);
+void	ft_popen_zygote_stop(void);
+
+// Returns 1 and sets *fd (-1 on failure) and *pid if the zygote took the
+// request, 0 if the caller must fork it itself.
+int	ft_zygote_popen(const char *file, char *const argv[], char type, int *fd,
+		pid_t *pid);
+
+// ft_popen_spawn.c
+// Opt-in backend for callers too large to fork cheaply and without a zygote:
+// commands are started with posix_spawnp, whose cost stays flat however much
+// memory the caller has. A file that cannot be executed is then an error of
+// ft_popen itself (-1 and errno) instead of a child exiting with 1. A running
+// zygote still takes precedence.
+void	ft_popen_use_spawn(int on);
+
+// Returns 1 and sets *fd (-1 on failure) and *pid if the spawn backend is
+// on, 0 if not.
+int	ft_spawn_popen(const char *file, char *const argv[], char type, int *fd,
+		pid_t *pid);
+
+#endif
@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "ft_popen.h"
+
+// One epoll instance watches the stdout of every running command, so a slow
+// command holds up none of the others. At the end of its output a command's
+// pidfd takes the place of its pipe and it is reaped once that polls
+// readable; without pidfds, ft_pclose waits for it there and then. Each
+// event carries the job's index, shifted left, with the low bit set for a
+// pidfd.
+#define RUN_CHUNK (1 << 16)
+#define RUN_EVENTS 64
+
+static uint64_t	now_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+// The pidfd leaves the set before it is closed: a command being forked at
+// that moment holds a copy of it until exec, and epoll would keep reporting
+// it for as long as the copy lives.
+static void	run_reap(int ep, popen_job *j)
+{
+	j->status = ft_pclose(j->fd);
+	j->fd = -1;
+	if (j->pidfd != -1)
+	{
+		epoll_ctl(ep, EPOLL_CTL_DEL, j->pidfd, NULL);
+		close(j->pidfd);
+	}
+	j->pidfd = -1;
+	j->ns = now_ns() - j->ns;
+}
+
+// 1 if the command is running, 0 if it could not be started, -1 if it could
+// not be watched (it is then killed).
+static int	run_start(int ep, popen_job *jobs, int i)
+{
+	struct epoll_event	ev;
+	popen_job			*j;
+
+	j = &jobs[i];
+	j->ns = now_ns();
+	j->fd = ft_popen(j->file, j->argv, 'r');
+	if (j->fd == -1)
+	{
+		j->ns = 0;
+		return (0);
+	}
+	ev.events = EPOLLIN;
+	ev.data.u64 = (uint64_t)i << 1;
+	if (fcntl(j->fd, F_SETFL, fcntl(j->fd, F_GETFL) | O_NONBLOCK) == -1
+		|| epoll_ctl(ep, EPOLL_CTL_ADD, j->fd, &ev) == -1)
+	{
+		kill(ft_popen_pid(j->fd), SIGKILL);
+		run_reap(ep, j);
+		return (-1);
+	}
+	return (1);
+}
+
+// Reads until the pipe is empty: 1 at the end of the output, which a read
+// error also is, 0 if more may come, -1 if out of memory.
+static int	run_read(popen_job *j)
+{
+	ssize_t	n;
+
+	while (1)
+	{
+		if (j->out.len == j->out.cap
+			&& !ft_popen_buf_reserve(&j->out, RUN_CHUNK))
+			return (-1);
+		n = read(j->fd, j->out.data + j->out.len, j->out.cap - j->out.len);
+		if (n == -1)
+			return (errno != EAGAIN && errno != EINTR);
+		if (n == 0)
+			return (1);
+		j->out.len += n;
+	}
+}
+
+// 1 if the event finished its job, 0 if not, -1 on error.
+static int	run_event(int ep, popen_job *jobs, uint64_t data)
+{
+	struct epoll_event	ev;
+	popen_job			*j;
+	int					r;
+
+	j = &jobs[data >> 1];
+	if (data & 1)
+		return (run_reap(ep, j), 1);
+	r = run_read(j);
+	if (r != 1)
+		return (r);
+	epoll_ctl(ep, EPOLL_CTL_DEL, j->fd, NULL);
+	j->pidfd = ft_popen_pidfd(j->fd);
+	ev.events = EPOLLIN;
+	ev.data.u64 = data | 1;
+	if (j->pidfd != -1 && epoll_ctl(ep, EPOLL_CTL_ADD, j->pidfd, &ev) == 0)
+		return (0);
+	run_reap(ep, j);
+	return (1);
+}
+
+static void	run_abort(int ep, popen_job *jobs, int n)
+{
+	int	i;
+
+	i = 0;
+	while (i < n)
+	{
+		if (jobs[i].fd != -1)
+		{
+			kill(ft_popen_pid(jobs[i].fd), SIGKILL);
+			run_reap(ep, &jobs[i]);
+		}
+		i++;
+	}
+}
+
+int	ft_popen_run(popen_job *jobs, int n, int max)
+{
+	struct epoll_event	ev[RUN_EVENTS];
+	int					ep;
+	int					next;
+	int					running;
+	int					ready;
+	int					r;
+
+	r = 0;
+	while (r < n)
+	{
+		jobs[r].status = -1;
+		jobs[r].ns = 0;
+		jobs[r].fd = -1;
+		jobs[r++].pidfd = -1;
+	}
+	ep = epoll_create1(EPOLL_CLOEXEC);
+	if (ep == -1)
+		return (-1);
+	if (max <= 0 || max > n)
+		max = n;
+	next = 0;
+	running = 0;
+	r = 0;
+	while (r != -1 && (next < n || running))
+	{
+		while (r != -1 && next < n && running < max)
+		{
+			r = run_start(ep, jobs, next++);
+			running += r == 1;
+		}
+		ready = r == -1 || !running ? 0 : epoll_wait(ep, ev, RUN_EVENTS, -1);
+		if (ready == -1 && errno != EINTR)
+			r = -1;
+		while (r != -1 && ready > 0)
+		{
+			r = run_event(ep, jobs, ev[--ready].data.u64);
+			running -= r == 1;
+		}
+	}
+	if (r == -1)
+	{
+		ready = errno;
+		run_abort(ep, jobs, n);
+		errno = ready;
+	}
+	close(ep);
+	return (r == -1 ? -1 : 0);
+}
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "ft_popen.h"
+
+// Two pipes rather than a socketpair: pipes move data with fewer copies and
+// can be enlarged. The pump never blocks on either end, so neither side can
+// wait on the other: a child that writes before it has read everything is
+// drained while its input is still being written.
+#define PUMP_PIPE_SIZE (1 << 20)
+#define PUMP_CHUNK (1 << 20)
+
+// The pipes are close-on-exec, so that no other child started meanwhile
+// holds this one's input open: only the copies made here reach the command.
+static int	rw_dup(int fd, int to)
+{
+	if (fd == to)
+		return (fcntl(fd, F_SETFD, 0));
+	return (dup2(fd, to));
+}
+
+static void	rw_child(const char *file, char *const argv[], int *in, int *out)
+{
+	if (rw_dup(in[0], 0) == -1 || rw_dup(out[1], 1) == -1)
+		exit(1);
+	execvp(file, argv);
+	exit(1);
+}
+
+int	ft_popen_rw(const char *file, char *const argv[], int fd[2])
+{
+	pid_t	pid;
+	int		in[2];
+	int		out[2];
+
+	if (!file || !argv || !fd || pipe2(in, O_CLOEXEC) == -1)
+		return (-1);
+	if (pipe2(out, O_CLOEXEC) == -1)
+	{
+		close(in[0]);
+		close(in[1]);
+		return (-1);
+	}
+	pid = fork();
+	if (pid == 0)
+		rw_child(file, argv, in, out);
+	close(in[0]);
+	close(out[1]);
+	if (pid == -1 || !ft_popen_track(out[0], pid))
+	{
+		close(in[1]);
+		close(out[0]);
+		if (pid != -1)
+		{
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+		}
+		return (-1);
+	}
+	fd[0] = out[0];
+	fd[1] = in[1];
+	return (0);
+}
+
+int	ft_popen_buf_reserve(popen_buf *b, size_t n)
+{
+	char	*data;
+	size_t	cap;
+
+	if (b->cap - b->len >= n)
+		return (1);
+	cap = b->cap ? b->cap : n;
+	while (cap - b->len < n)
+		cap *= 2;
+	data = realloc(b->data, cap);
+	if (!data)
+		return (0);
+	b->data = data;
+	b->cap = cap;
+	return (1);
+}
+
+// Writes until the pipe is full. A reader that has gone away ends the
+// input, as if it had all been written.
+static int	pump_write(int *fd, const char *in, size_t len, size_t *done)
+{
+	ssize_t	n;
+
+	while (*done < len)
+	{
+		n = write(*fd, in + *done, len - *done);
+		if (n == -1 && errno == EPIPE)
+			break ;
+		if (n == -1)
+			return (errno == EAGAIN || errno == EINTR);
+		*done += n;
+	}
+	close(*fd);
+	*fd = -1;
+	return (1);
+}
+
+// Reads until the pipe is empty; 0 at end of output or on error.
+static int	pump_read(int *fd, popen_buf *out, int *eof)
+{
+	ssize_t	n;
+
+	while (1)
+	{
+		if (!ft_popen_buf_reserve(out, PUMP_CHUNK))
+			return (0);
+		n = read(*fd, out->data + out->len, out->cap - out->len);
+		if (n == -1)
+			return (errno == EAGAIN || errno == EINTR);
+		if (n == 0)
+		{
+			*eof = 1;
+			return (1);
+		}
+		out->len += n;
+	}
+}
+
+// SIGPIPE is blocked while pumping so that a child that stops reading shows
+// up as EPIPE; one raised here is consumed before the old mask returns.
+static int	pump_loop(int *fd, const char *in, size_t len, popen_buf *out)
+{
+	struct pollfd	p[2];
+	size_t			done;
+	int				eof;
+	int				ok;
+
+	done = 0;
+	eof = 0;
+	ok = 1;
+	while (ok && !eof)
+	{
+		p[0].fd = fd[0];
+		p[0].events = POLLIN;
+		p[1].fd = fd[1];
+		p[1].events = POLLOUT;
+		p[0].revents = 0;
+		p[1].revents = 0;
+		if (poll(p, fd[1] == -1 ? 1 : 2, -1) == -1 && errno != EINTR)
+			ok = 0;
+		else if (fd[1] != -1 && p[1].revents)
+			ok = pump_write(&fd[1], in, len, &done);
+		if (ok && p[0].revents)
+			ok = pump_read(&fd[0], out, &eof);
+	}
+	return (ok);
+}
+
+int	ft_popen_pump(int fd[2], const void *in, size_t len, popen_buf *out)
+{
+	sigset_t		block;
+	sigset_t		old;
+	struct timespec	zero;
+	int				pending;
+	int				err;
+	int				ok;
+
+	sigemptyset(&block);
+	sigaddset(&block, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	sigpending(&block);
+	pending = sigismember(&block, SIGPIPE);
+	fcntl(fd[0], F_SETPIPE_SZ, PUMP_PIPE_SIZE);
+	fcntl(fd[1], F_SETPIPE_SZ, PUMP_PIPE_SIZE);
+	ok = fcntl(fd[0], F_SETFL, fcntl(fd[0], F_GETFL) | O_NONBLOCK) != -1
+		&& fcntl(fd[1], F_SETFL, fcntl(fd[1], F_GETFL) | O_NONBLOCK) != -1
+		&& pump_loop(fd, in, len, out);
+	err = errno;
+	if (fd[1] != -1)
+		close(fd[1]);
+	fd[1] = -1;
+	sigemptyset(&block);
+	sigaddset(&block, SIGPIPE);
+	zero.tv_sec = 0;
+	zero.tv_nsec = 0;
+	if (!pending)
+		while (sigtimedwait(&block, NULL, &zero) == SIGPIPE)
+			;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	errno = err;
+	return (ok ? 0 : -1);
+}
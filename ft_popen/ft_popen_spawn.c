@@ -0,0 +1,63 @@
+#include <errno.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "ft_popen.h"
+
+// posix_spawnp with the child's dup2 and closes as file actions. glibc runs
+// it as clone(CLONE_VM | CLONE_VFORK) on a small stack of its own, so no page
+// table is copied and the cost does not grow with the caller's memory; it
+// also blocks signals and resets handlers around the shared address space,
+// which a bare vfork would leave to us. The one difference from fork: a file
+// that cannot be executed makes ft_popen return -1 with errno, where a forked
+// child would start and exit with 1.
+extern char	**environ;
+
+static atomic_int	g_spawn;
+
+void	ft_popen_use_spawn(int on)
+{
+	atomic_store(&g_spawn, on != 0);
+}
+
+static int	spawn_actions(posix_spawn_file_actions_t *fa, int *fd, char type)
+{
+	if (posix_spawn_file_actions_init(fa))
+		return (0);
+	if (!posix_spawn_file_actions_adddup2(fa, type == 'r' ? fd[1] : fd[0],
+			type == 'r' ? 1 : 0)
+		&& !posix_spawn_file_actions_addclose(fa, fd[0])
+		&& !posix_spawn_file_actions_addclose(fa, fd[1]))
+		return (1);
+	posix_spawn_file_actions_destroy(fa);
+	return (0);
+}
+
+int	ft_spawn_popen(const char *file, char *const argv[], char type, int *fd,
+		pid_t *pid)
+{
+	posix_spawn_file_actions_t	fa;
+	int							p[2];
+	int							err;
+
+	if (!atomic_load(&g_spawn))
+		return (0);
+	*fd = -1;
+	if (pipe(p) == -1)
+		return (1);
+	err = ENOMEM;
+	if (spawn_actions(&fa, p, type))
+	{
+		err = posix_spawnp(pid, file, &fa, NULL, argv, environ);
+		posix_spawn_file_actions_destroy(&fa);
+	}
+	close(type == 'r' ? p[1] : p[0]);
+	if (!err)
+		*fd = type == 'r' ? p[0] : p[1];
+	else
+	{
+		close(type == 'r' ? p[0] : p[1]);
+		errno = err;
+	}
+	return (1);
+}
@@ -0,0 +1,104 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "ft_popen.h"
+
+// fds are small and dense, so the table is a plain array indexed by fd that
+// doubles to fit the largest one seen; 0 marks an fd with no child.
+#define TABLE_MIN 64
+
+typedef struct popen_table {
+	pid_t			*pids;
+	size_t			cap;
+	pthread_mutex_t	lock;
+}	popen_table;
+
+static popen_table	g_table = {NULL, 0, PTHREAD_MUTEX_INITIALIZER};
+
+int	ft_popen_track(int fd, pid_t pid)
+{
+	pid_t	*pids;
+	size_t	cap;
+	int		ok;
+
+	pthread_mutex_lock(&g_table.lock);
+	ok = 1;
+	if ((size_t)fd >= g_table.cap)
+	{
+		cap = g_table.cap ? g_table.cap : TABLE_MIN;
+		while (cap <= (size_t)fd)
+			cap *= 2;
+		pids = realloc(g_table.pids, cap * sizeof(*pids));
+		ok = pids != NULL;
+		while (ok && g_table.cap < cap)
+			pids[g_table.cap++] = 0;
+		if (ok)
+			g_table.pids = pids;
+	}
+	if (ok)
+		g_table.pids[fd] = pid;
+	pthread_mutex_unlock(&g_table.lock);
+	return (ok);
+}
+
+// Returns the child's pid and forgets it when take is set.
+static pid_t	table_get(int fd, int take)
+{
+	pid_t	pid;
+
+	pid = -1;
+	pthread_mutex_lock(&g_table.lock);
+	if (fd >= 0 && (size_t)fd < g_table.cap && g_table.pids[fd] > 0)
+	{
+		pid = g_table.pids[fd];
+		if (take)
+			g_table.pids[fd] = 0;
+	}
+	pthread_mutex_unlock(&g_table.lock);
+	return (pid);
+}
+
+pid_t	ft_popen_pid(int fd)
+{
+	return (table_get(fd, 0));
+}
+
+int	ft_pclose(int fd)
+{
+	pid_t	pid;
+	int		status;
+
+	pid = table_get(fd, 1);
+	if (pid == -1)
+	{
+		errno = EBADF;
+		return (-1);
+	}
+	close(fd);
+	while (waitpid(pid, &status, 0) == -1)
+		if (errno != EINTR)
+			return (-1);
+	return (status);
+}
+
+int	ft_popen_pidfd(int fd)
+{
+	pid_t	pid;
+
+	pid = table_get(fd, 0);
+	if (pid == -1)
+	{
+		errno = EBADF;
+		return (-1);
+	}
+#ifdef SYS_pidfd_open
+	return ((int)syscall(SYS_pidfd_open, pid, 0));
+#else
+	errno = ENOSYS;
+	return (-1);
+#endif
+}
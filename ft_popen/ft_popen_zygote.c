@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "ft_popen.h"
+
+// A request is one SOCK_SEQPACKET message: the type, the number of strings
+// in file and argv, then those strings and the caller's environ, each
+// NUL-terminated. The caller's fds 0, 1 and 2 and an O_PATH fd of its working
+// directory are attached, so that the command starts with the caller's
+// streams, directory and environment as they are now, not as they were when
+// the zygote started. The reply carries the pid, or -1 and errno, and the
+// caller's end of the pipe. One request is in flight at a time, and only from
+// the process that started the zygote: the commands become its children, so
+// a process forked from it forks its own.
+#if defined(__linux__) && defined(CLONE_PARENT) && defined(SYS_clone)
+# define ZYGOTE_CLONE 1
+#endif
+
+// fds 0, 1 and 2, then the working directory.
+#define ZYGOTE_FDS 4
+
+extern char	**environ;
+
+typedef struct zygote {
+	int				sock;
+	pid_t			pid;
+	pid_t			owner;
+	pthread_mutex_t	lock;
+	char			buf[ZYGOTE_MSG_MAX];
+}	zygote;
+
+typedef struct zygote_reply {
+	pid_t	pid;
+	int		err;
+}	zygote_reply;
+
+static zygote	g_zygote = {-1, -1, -1, PTHREAD_MUTEX_INITIALIZER, {0}};
+
+typedef union zygote_ctl {
+	struct cmsghdr	h;
+	char			buf[CMSG_SPACE(ZYGOTE_FDS * sizeof(int))];
+}	zygote_ctl;
+
+static ssize_t	zygote_send(int sock, const void *data, size_t len,
+					const int *fds, int n)
+{
+	zygote_ctl		ctl;
+	struct msghdr	m;
+	struct iovec	iov;
+
+	memset(&m, 0, sizeof(m));
+	iov.iov_base = (void *)data;
+	iov.iov_len = len;
+	m.msg_iov = &iov;
+	m.msg_iovlen = 1;
+	if (n)
+	{
+		m.msg_control = ctl.buf;
+		m.msg_controllen = CMSG_SPACE(n * sizeof(int));
+		ctl.h.cmsg_level = SOL_SOCKET;
+		ctl.h.cmsg_type = SCM_RIGHTS;
+		ctl.h.cmsg_len = CMSG_LEN(n * sizeof(int));
+		memcpy(CMSG_DATA(&ctl.h), fds, n * sizeof(int));
+	}
+	return (sendmsg(sock, &m, MSG_NOSIGNAL));
+}
+
+// Returns the length of the message, whose fds are stored in fds and counted
+// in *n; a truncated message is an error, fds that did not fit are not.
+static ssize_t	zygote_recv(int sock, void *data, size_t len, int *fds, int *n,
+					int flags)
+{
+	zygote_ctl		ctl;
+	struct msghdr	m;
+	struct iovec	iov;
+	ssize_t			r;
+
+	memset(&m, 0, sizeof(m));
+	iov.iov_base = data;
+	iov.iov_len = len;
+	m.msg_iov = &iov;
+	m.msg_iovlen = 1;
+	m.msg_control = ctl.buf;
+	m.msg_controllen = sizeof(ctl.buf);
+	r = recvmsg(sock, &m, flags);
+	*n = 0;
+	if (r > 0 && m.msg_controllen >= CMSG_LEN(sizeof(int))
+		&& ctl.h.cmsg_level == SOL_SOCKET && ctl.h.cmsg_type == SCM_RIGHTS)
+	{
+		*n = (ctl.h.cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(&ctl.h), *n * sizeof(int));
+	}
+	if (r > 0 && m.msg_flags & MSG_TRUNC)
+	{
+		errno = EMSGSIZE;
+		r = -1;
+	}
+	return (r);
+}
+
+#ifdef ZYGOTE_CLONE
+
+// The command: the caller's streams on 0, 1 and 2, then the pipe end over
+// one of them, as in ft_popen, in the caller's directory. execvp searches the
+// PATH of environ, so environ is the caller's before it runs.
+static void	zygote_exec(char **args, char **env, char type, int *fd,
+				const int *std)
+{
+	int	i;
+
+	i = 0;
+	while (i < 3)
+	{
+		if (dup2(std[i], i) == -1)
+			_exit(1);
+		i++;
+	}
+	if (dup2(type == 'r' ? fd[1] : fd[0], type == 'r' ? 1 : 0) == -1)
+		_exit(1);
+	close(fd[0]);
+	close(fd[1]);
+	if (fchdir(std[3]) == -1)
+		_exit(1);
+	environ = env;
+	execvp(args[0], args + 1);
+	_exit(1);
+}
+
+// Splits the strings into args, then NULL and the environment, then NULL.
+// Every string takes at least its NUL, so there are fewer than len of them.
+static int	zygote_split(char *msg, size_t len, char **args)
+{
+	size_t	i;
+	int		argc;
+	int		n;
+
+	memcpy(&argc, msg + 1, sizeof(argc));
+	if (argc < 1 || msg[len - 1])
+		return (0);
+	n = 0;
+	i = 1 + sizeof(argc);
+	while (i < len)
+	{
+		if (n == argc)
+			args[n++] = NULL;
+		args[n++] = msg + i;
+		i += strlen(msg + i) + 1;
+	}
+	if (n < argc)
+		return (0);
+	if (n == argc)
+		args[n++] = NULL;
+	args[n] = NULL;
+	return (1);
+}
+
+static void	zygote_spawn(int sock, char *msg, size_t len, const int *std)
+{
+	static char		*args[ZYGOTE_MSG_MAX + 2];
+	zygote_reply	r;
+	int				argc;
+	int				fd[2];
+
+	r.err = 0;
+	r.pid = -1;
+	if (!zygote_split(msg, len, args))
+		r.err = EINVAL;
+	else if (pipe(fd) == -1)
+		r.err = errno;
+	if (r.err)
+	{
+		zygote_send(sock, &r, sizeof(r), NULL, 0);
+		return ;
+	}
+	memcpy(&argc, msg + 1, sizeof(argc));
+	r.pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+	if (r.pid == 0)
+		zygote_exec(args, args + argc + 1, msg[0], fd, std);
+	r.err = r.pid == -1 ? errno : 0;
+	zygote_send(sock, &r, sizeof(r), &fd[msg[0] == 'r' ? 0 : 1],
+		r.pid != -1);
+	close(fd[0]);
+	close(fd[1]);
+}
+
+// Only the socket and the standard streams stay open: a pipe end the caller
+// had open when the zygote started must not be held open by it. The streams
+// that come with a request are close-on-exec.
+static void	zygote_loop(int sock)
+{
+	int		std[ZYGOTE_FDS];
+	ssize_t	len;
+	int		n;
+	int		i;
+
+	i = 3;
+	while (i < sock)
+		close(i++);
+	i = sock + 1;
+#ifdef SYS_close_range
+	if (syscall(SYS_close_range, i, ~0U, 0) == 0)
+		i = sysconf(_SC_OPEN_MAX);
+#endif
+	while (i < sysconf(_SC_OPEN_MAX))
+		close(i++);
+	while (1)
+	{
+		len = zygote_recv(sock, g_zygote.buf, sizeof(g_zygote.buf), std, &n,
+				MSG_CMSG_CLOEXEC);
+		if (len == 0)
+			_exit(0);
+		if (len > (ssize_t)(1 + sizeof(int)) && n == ZYGOTE_FDS)
+			zygote_spawn(sock, g_zygote.buf, (size_t)len, std);
+		else if (len != -1 || errno != EINTR)
+			zygote_send(sock, &(zygote_reply){-1, EINVAL}, sizeof(zygote_reply),
+				NULL, 0);
+		while (n > 0)
+			close(std[--n]);
+	}
+}
+
+int	ft_popen_zygote_start(void)
+{
+	int		sv[2];
+	pid_t	pid;
+
+	pthread_mutex_lock(&g_zygote.lock);
+	pid = 0;
+	if (g_zygote.sock == -1)
+	{
+		pid = -1;
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == 0)
+		{
+			pid = fork();
+			if (pid == 0)
+				zygote_loop(sv[1]);
+			close(sv[1]);
+			if (pid == -1)
+				close(sv[0]);
+			else
+			{
+				g_zygote.sock = sv[0];
+				g_zygote.pid = pid;
+				g_zygote.owner = getpid();
+			}
+		}
+	}
+	pthread_mutex_unlock(&g_zygote.lock);
+	return (pid == -1 ? -1 : 0);
+}
+
+#else
+
+int	ft_popen_zygote_start(void)
+{
+	errno = ENOSYS;
+	return (-1);
+}
+
+#endif
+
+void	ft_popen_zygote_stop(void)
+{
+	pthread_mutex_lock(&g_zygote.lock);
+	if (g_zygote.sock != -1 && g_zygote.owner == getpid())
+	{
+		close(g_zygote.sock);
+		waitpid(g_zygote.pid, NULL, 0);
+		g_zygote.sock = -1;
+		g_zygote.pid = -1;
+	}
+	pthread_mutex_unlock(&g_zygote.lock);
+}
+
+// Appends the strings of v; -1 if they do not fit.
+static int	zygote_pack_strs(char *buf, size_t *len, char *const v[])
+{
+	size_t	n;
+	int		i;
+
+	i = 0;
+	while (v && v[i])
+	{
+		n = strlen(v[i]) + 1;
+		if (*len + n > ZYGOTE_MSG_MAX)
+			return (-1);
+		memcpy(buf + *len, v[i++], n);
+		*len += n;
+	}
+	return (i);
+}
+
+static size_t	zygote_pack(char *buf, const char *file, char *const argv[],
+					char type)
+{
+	size_t	len;
+	int		argc;
+
+	buf[0] = type;
+	len = 1 + sizeof(argc);
+	argc = zygote_pack_strs(buf, &len, (char *const []){(char *)file, NULL});
+	if (argc != -1)
+		argc = zygote_pack_strs(buf, &len, argv);
+	if (argc == -1 || zygote_pack_strs(buf, &len, environ) == -1)
+		return (0);
+	argc++;
+	memcpy(buf + 1, &argc, sizeof(argc));
+	return (len);
+}
+
+// A pid that comes without exactly one fd is a failure all the same: the
+// command is running, so it is killed and reaped here.
+static int	zygote_reply_fd(const zygote_reply *r, ssize_t len, int *got,
+				int n)
+{
+	if (len == sizeof(*r) && r->pid != -1 && n == 1)
+		return (got[0]);
+	while (n > 0)
+		close(got[--n]);
+	if (len == sizeof(*r) && r->pid != -1)
+	{
+		kill(r->pid, SIGKILL);
+		waitpid(r->pid, NULL, 0);
+		errno = EPROTO;
+	}
+	else if (len == sizeof(*r))
+		errno = r->err;
+	else if (len != -1)
+		errno = EPROTO;
+	return (-1);
+}
+
+// A zygote that has gone away, or a request it cannot carry, leaves the
+// request to the caller. Once a request is sent, a failed pipe or clone in
+// the zygote, or a reply that cannot be received, is the caller's failure.
+int	ft_zygote_popen(const char *file, char *const argv[], char type, int *fd,
+		pid_t *pid)
+{
+	zygote_reply	r;
+	ssize_t			len;
+	int				fds[ZYGOTE_FDS];
+	int				n;
+	int				ok;
+
+	pthread_mutex_lock(&g_zygote.lock);
+	ok = 0;
+	len = 0;
+	fds[3] = -1;
+	if (g_zygote.sock != -1 && g_zygote.owner == getpid())
+		fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fds[3] != -1)
+		len = zygote_pack(g_zygote.buf, file, argv, type);
+	fds[0] = 0;
+	fds[1] = 1;
+	fds[2] = 2;
+	if (len)
+		ok = zygote_send(g_zygote.sock, g_zygote.buf, len, fds, ZYGOTE_FDS)
+			== len;
+	if (fds[3] != -1)
+		close(fds[3]);
+	if (ok)
+	{
+		r.pid = -1;
+		len = zygote_recv(g_zygote.sock, &r, sizeof(r), fds, &n, 0);
+		*fd = zygote_reply_fd(&r, len, fds, n);
+		*pid = *fd == -1 ? -1 : r.pid;
+	}
+	pthread_mutex_unlock(&g_zygote.lock);
+	return (ok);
+}
@@ -1,13 +1,14 @@
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <dirent.h>
-
-// Include the ft_popen function prototype
-int ft_popen(const char *file, char *const argv[], char type);
+#include <poll.h>
+#include <time.h>
+#include "ft_popen.h"
 
 // Function to count open file descriptors for current process
 int count_open_fds() {
@@ -165,20 +166,20 @@ void test_stress_multiple_operations() {
         }
     }
     
-    // Read from all and close
+    // Read from all, then close each one and reap exactly its child
+    int all_exited = 1;
     for (int i = 0; i < num_ops; i++) {
         char buffer[100];
         read(fds[i], buffer, sizeof(buffer));
-        close(fds[i]);
-    }
-    
-    // Wait for all children
-    for (int i = 0; i < num_ops; i++) {
-        wait(NULL);
+        int status = ft_pclose(fds[i]);
+        if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            all_exited = 0;
     }
     
     int final_fd_count = count_open_fds();
-    if (final_fd_count <= initial_fd_count + 2) { // Allow small variance
+    if (!all_exited) {
+        printf("❌ Stress Test FAILED: ft_pclose did not return a clean exit\n");
+    } else if (final_fd_count <= initial_fd_count + 2) { // Allow small variance
         printf("✅ Stress Test PASSED: Multiple operations handled correctly\n");
     } else {
         printf("❌ Stress Test FAILED: FD leak in multiple operations (%d -> %d)\n",
@@ -186,6 +187,388 @@ void test_stress_multiple_operations() {
     }
 }
 
+void test_pclose_exact_child() {
+    printf("\n=== Testing FT_PCLOSE ===\n");
+
+    // Test 1: each fd reaps its own child, in any order
+    int fd3 = ft_popen("sh", (char *[]){"sh", "-c", "exit 3", NULL}, 'r');
+    int fd4 = ft_popen("sh", (char *[]){"sh", "-c", "exit 4", NULL}, 'r');
+    int status4 = ft_pclose(fd4);
+    int status3 = ft_pclose(fd3);
+    if (WIFEXITED(status3) && WEXITSTATUS(status3) == 3
+        && WIFEXITED(status4) && WEXITSTATUS(status4) == 4) {
+        printf("✅ Pclose Test 1 PASSED: Exit statuses 3 and 4 matched their fds\n");
+    } else {
+        printf("❌ Pclose Test 1 FAILED: Got statuses %d and %d\n", status3, status4);
+    }
+
+    // Test 2: unknown fds and fds closed twice are rejected
+    int fd = ft_popen("true", (char *[]){"true", NULL}, 'r');
+    ft_pclose(fd);
+    if (ft_pclose(fd) == -1 && ft_pclose(-1) == -1 && ft_pclose(0) == -1) {
+        printf("✅ Pclose Test 2 PASSED: Unknown fds return -1\n");
+    } else {
+        printf("❌ Pclose Test 2 FAILED: Unknown fd was accepted\n");
+    }
+
+    // Test 3: the pidfd polls readable once the child exits
+    fd = ft_popen("sh", (char *[]){"sh", "-c", "exit 6", NULL}, 'r');
+    int pidfd = ft_popen_pidfd(fd);
+    if (pidfd == -1) {
+        printf("⚠️  Pclose Test 3 SKIPPED: no pidfd support\n");
+        ft_pclose(fd);
+        return;
+    }
+    struct pollfd p = {pidfd, POLLIN, 0};
+    int ready = poll(&p, 1, 5000);
+    int status = ft_pclose(fd);
+    close(pidfd);
+    if (ready == 1 && WIFEXITED(status) && WEXITSTATUS(status) == 6) {
+        printf("✅ Pclose Test 3 PASSED: pidfd signalled the exit, status 6\n");
+    } else {
+        printf("❌ Pclose Test 3 FAILED: poll %d, status %d\n", ready, status);
+    }
+}
+
+static double now_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Spawns and reaps n short commands, returning the average milliseconds.
+static double time_spawns(int n) {
+    double start = now_ms();
+
+    for (int i = 0; i < n; i++) {
+        int fd = ft_popen("true", (char *[]){"true", NULL}, 'r');
+        if (fd == -1)
+            return -1;
+        close(fd);
+        wait(NULL);
+    }
+    return (now_ms() - start) / n;
+}
+
+void test_zygote_pool() {
+    printf("\n=== Testing ZYGOTE POOL ===\n");
+
+    int initial_fd_count = count_open_fds();
+    if (ft_popen_zygote_start() == -1) {
+        printf("⚠️  Zygote Test SKIPPED: no zygote on this system\n");
+        return;
+    }
+
+    // Test 1: 'r' through the zygote, reaped by the caller
+    char buffer[100] = {0};
+    int fd = ft_popen("echo", (char *[]){"echo", "zygote", NULL}, 'r');
+    ssize_t n = fd == -1 ? -1 : read(fd, buffer, sizeof(buffer) - 1);
+    if (fd != -1)
+        close(fd);
+    pid_t reaped = wait(NULL);
+    if (n == 7 && strcmp(buffer, "zygote\n") == 0 && reaped > 0) {
+        printf("✅ Zygote Test 1 PASSED: Output read and child reaped by caller\n");
+    } else {
+        printf("❌ Zygote Test 1 FAILED: Got %zd bytes, reaped %d\n", n, reaped);
+    }
+
+    // Test 2: 'w' through the zygote, exit status seen by the caller
+    int status = 0;
+    fd = ft_popen("sh", (char *[]){"sh", "-c", "read x; exit $x", NULL}, 'w');
+    if (fd != -1) {
+        write(fd, "7\n", 2);
+        close(fd);
+        wait(&status);
+    }
+    if (fd != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 7) {
+        printf("✅ Zygote Test 2 PASSED: Input written, exit status 7\n");
+    } else {
+        printf("❌ Zygote Test 2 FAILED: Write end or exit status wrong\n");
+    }
+
+    // Test 3: the command gets the caller's current stdin, as in the subject
+    int saved = dup(0);
+    fd = ft_popen("printf", (char *[]){"printf", "a\\nc\\nb\\n", NULL}, 'r');
+    dup2(fd, 0);
+    close(fd);
+    fd = ft_popen("grep", (char *[]){"grep", "c", NULL}, 'r');
+    dup2(saved, 0);
+    close(saved);
+    memset(buffer, 0, sizeof(buffer));
+    n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    wait(NULL);
+    wait(NULL);
+    if (n == 2 && strcmp(buffer, "c\n") == 0) {
+        printf("✅ Zygote Test 3 PASSED: Piped stdin reached the command\n");
+    } else {
+        printf("❌ Zygote Test 3 FAILED: Expected \"c\\n\", got \"%s\"\n", buffer);
+    }
+
+    // Test 4: the command runs in the caller's current directory and environment
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) && chdir("/") == 0) {
+        setenv("FT_POPEN_ZYGOTE", "42", 1);
+        fd = ft_popen("sh", (char *[]){"sh", "-c", "echo $PWD $FT_POPEN_ZYGOTE", NULL}, 'r');
+        memset(buffer, 0, sizeof(buffer));
+        n = fd == -1 ? -1 : read(fd, buffer, sizeof(buffer) - 1);
+        status = fd == -1 ? -1 : ft_pclose(fd);
+        unsetenv("FT_POPEN_ZYGOTE");
+        chdir(cwd);
+        if (strcmp(buffer, "/ 42\n") == 0 && WIFEXITED(status)) {
+            printf("✅ Zygote Test 4 PASSED: Caller's directory and environment used\n");
+        } else {
+            printf("❌ Zygote Test 4 FAILED: Expected \"/ 42\\n\", got \"%s\"\n", buffer);
+        }
+    }
+
+    // Test 5: spawn cost once the caller has grown, zygote vs. fork
+    size_t size = (size_t)256 << 20;
+    char *heap = malloc(size);
+    if (heap) {
+        memset(heap, 1, size);
+        double pooled = time_spawns(100);
+        ft_popen_zygote_stop();
+        double forked = time_spawns(100);
+        printf("ℹ️  Spawn with a 256 MB heap: %.3f ms via zygote, %.3f ms via fork\n",
+               pooled, forked);
+        free(heap);
+    }
+    ft_popen_zygote_stop();
+
+    int final_fd_count = count_open_fds();
+    if (final_fd_count <= initial_fd_count) {
+        printf("✅ Zygote FD Test PASSED: No FD leaks once stopped\n");
+    } else {
+        printf("❌ Zygote FD Test FAILED: FD leak detected (%d -> %d)\n",
+               initial_fd_count, final_fd_count);
+    }
+}
+
+void test_spawn_backend() {
+    printf("\n=== Testing POSIX_SPAWN BACKEND ===\n");
+
+    int initial_fd_count = count_open_fds();
+    ft_popen_use_spawn(1);
+
+    // Test 1: 'r' and 'w' behave as with fork
+    char buffer[100] = {0};
+    int fd = ft_popen("echo", (char *[]){"echo", "spawned", NULL}, 'r');
+    ssize_t n = fd == -1 ? -1 : read(fd, buffer, sizeof(buffer) - 1);
+    if (fd != -1)
+        close(fd);
+    wait(NULL);
+    int status = 0;
+    int wfd = ft_popen("sh", (char *[]){"sh", "-c", "read x; exit $x", NULL}, 'w');
+    if (wfd != -1) {
+        write(wfd, "5\n", 2);
+        close(wfd);
+        wait(&status);
+    }
+    if (n == 8 && strcmp(buffer, "spawned\n") == 0 && wfd != -1
+        && WIFEXITED(status) && WEXITSTATUS(status) == 5) {
+        printf("✅ Spawn Test 1 PASSED: Read and write ends work\n");
+    } else {
+        printf("❌ Spawn Test 1 FAILED: Got %zd bytes, exit status %d\n",
+               n, WEXITSTATUS(status));
+    }
+
+    // Test 2: a command that cannot run is an error of ft_popen itself
+    errno = 0;
+    fd = ft_popen("nonexistent_command_xyz",
+                  (char *[]){"nonexistent_command_xyz", NULL}, 'r');
+    if (fd == -1 && errno == ENOENT) {
+        printf("✅ Spawn Test 2 PASSED: Bad command returns -1 with ENOENT\n");
+    } else {
+        printf("❌ Spawn Test 2 FAILED: Got fd %d, errno %d\n", fd, errno);
+        if (fd != -1)
+            close(fd);
+    }
+
+    ft_popen_use_spawn(0);
+    int final_fd_count = count_open_fds();
+    if (final_fd_count <= initial_fd_count) {
+        printf("✅ Spawn FD Test PASSED: No FD leaks\n");
+    } else {
+        printf("❌ Spawn FD Test FAILED: FD leak detected (%d -> %d)\n",
+               initial_fd_count, final_fd_count);
+    }
+}
+
+void test_popen_rw() {
+    printf("\n=== Testing RW MODE ===\n");
+
+    int initial_fd_count = count_open_fds();
+
+    // Test 1: 64 MB through cat, far more than both pipes hold
+    size_t size = (size_t)64 << 20;
+    char *in = malloc(size);
+    popen_buf out = {0};
+    int fd[2];
+    int status = -1;
+    int rc = -1;
+    double ms = 0;
+    if (in) {
+        for (size_t i = 0; i < size; i++)
+            in[i] = (char)(i * 131 + (i >> 12));
+        if (ft_popen_rw("cat", (char *[]){"cat", NULL}, fd) == 0) {
+            double start = now_ms();
+            rc = ft_popen_pump(fd, in, size, &out);
+            ms = now_ms() - start;
+            status = ft_pclose(fd[0]);
+        }
+    }
+    if (rc == 0 && out.len == size && memcmp(in, out.data, size) == 0
+        && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        printf("✅ RW Test 1 PASSED: 64 MB came back through cat unchanged\n");
+        printf("ℹ️  Pumped 64 MB each way in %.1f ms (%.0f MB/s)\n",
+               ms, 64 / (ms / 1e3));
+    } else {
+        printf("❌ RW Test 1 FAILED: pump %d, got %zu of %zu bytes\n",
+               rc, out.len, size);
+    }
+
+    // Test 2: output that only comes once all of the input is read
+    out.len = 0;
+    rc = ft_popen_rw("wc", (char *[]){"wc", "-c", NULL}, fd);
+    if (rc == 0) {
+        rc = ft_popen_pump(fd, in, in ? size : 0, &out);
+        status = ft_pclose(fd[0]);
+    }
+    char expect[32];
+    snprintf(expect, sizeof(expect), "%zu\n", in ? size : 0);
+    if (rc == 0 && out.len == strlen(expect)
+        && memcmp(out.data, expect, out.len) == 0) {
+        printf("✅ RW Test 2 PASSED: wc -c counted every byte\n");
+    } else {
+        printf("❌ RW Test 2 FAILED: pump %d, got %zu bytes\n", rc, out.len);
+    }
+
+    // Test 3: a command that stops reading ends the input without SIGPIPE
+    out.len = 0;
+    rc = ft_popen_rw("head", (char *[]){"head", "-c", "10", NULL}, fd);
+    if (rc == 0) {
+        rc = ft_popen_pump(fd, in, in ? size : 0, &out);
+        status = ft_pclose(fd[0]);
+    }
+    if (rc == 0 && out.len == 10 && in && memcmp(out.data, in, 10) == 0
+        && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        printf("✅ RW Test 3 PASSED: Early exit handled, first 10 bytes kept\n");
+    } else {
+        printf("❌ RW Test 3 FAILED: pump %d, got %zu bytes\n", rc, out.len);
+    }
+
+    // Test 4: a second command must not hold the first one's input open
+    int fd2[2];
+    popen_buf out2 = {0};
+    int rc2 = -1;
+    out.len = 0;
+    rc = ft_popen_rw("cat", (char *[]){"cat", NULL}, fd);
+    if (rc == 0 && ft_popen_rw("cat", (char *[]){"cat", NULL}, fd2) == 0) {
+        alarm(10);  // without close-on-exec the first pump never ends
+        rc = ft_popen_pump(fd, "first", 5, &out);
+        ft_pclose(fd[0]);
+        rc2 = ft_popen_pump(fd2, "second", 6, &out2);
+        ft_pclose(fd2[0]);
+        alarm(0);
+    } else if (rc == 0) {
+        close(fd[1]);
+        ft_pclose(fd[0]);
+    }
+    if (rc == 0 && rc2 == 0 && out.len == 5 && memcmp(out.data, "first", 5) == 0
+        && out2.len == 6 && memcmp(out2.data, "second", 6) == 0) {
+        printf("✅ RW Test 4 PASSED: Overlapping commands got their own EOF\n");
+    } else {
+        printf("❌ RW Test 4 FAILED: pump %d and %d\n", rc, rc2);
+    }
+    free(out2.data);
+    free(out.data);
+    free(in);
+
+    int final_fd_count = count_open_fds();
+    if (final_fd_count <= initial_fd_count) {
+        printf("✅ RW FD Test PASSED: No FD leaks\n");
+    } else {
+        printf("❌ RW FD Test FAILED: FD leak detected (%d -> %d)\n",
+               initial_fd_count, final_fd_count);
+    }
+}
+
+void test_popen_runner() {
+    printf("\n=== Testing EPOLL RUNNER ===\n");
+
+    int initial_fd_count = count_open_fds();
+    enum { JOBS = 200 };
+    static popen_job jobs[JOBS];
+    static char words[JOBS][16];
+    static char *args[JOBS][3];
+
+    // Job 0 is slow, job 1 is large, job 2 cannot run, the rest echo a number
+    memset(jobs, 0, sizeof(jobs));
+    jobs[0].file = "sh";
+    jobs[0].argv = (char *[]){"sh", "-c", "sleep 1; echo slow", NULL};
+    jobs[1].file = "head";
+    jobs[1].argv = (char *[]){"head", "-c", "1000000", "/dev/zero", NULL};
+    jobs[2].file = "nonexistent_command_xyz";
+    jobs[2].argv = (char *[]){"nonexistent_command_xyz", NULL};
+    for (int i = 3; i < JOBS; i++) {
+        snprintf(words[i], sizeof(words[i]), "%d", i);
+        args[i][0] = "echo";
+        args[i][1] = words[i];
+        args[i][2] = NULL;
+        jobs[i].file = "echo";
+        jobs[i].argv = args[i];
+    }
+
+    double start = now_ms();
+    int rc = ft_popen_run(jobs, JOBS, 32);
+    double ms = now_ms() - start;
+
+    // Test 1: every output and exit status belongs to its own job
+    int bad = rc != 0;
+    size_t bytes = 0;
+    uint64_t slowest = 0;
+    for (int i = 3; i < JOBS; i++) {
+        if (jobs[i].out.len != strlen(words[i]) + 1
+            || memcmp(jobs[i].out.data, words[i], strlen(words[i])) != 0
+            || !WIFEXITED(jobs[i].status) || WEXITSTATUS(jobs[i].status) != 0)
+            bad++;
+        if (jobs[i].ns > slowest)
+            slowest = jobs[i].ns;
+    }
+    for (int i = 0; i < JOBS; i++)
+        bytes += jobs[i].out.len;
+    if (jobs[0].out.len != 5 || memcmp(jobs[0].out.data, "slow\n", 5) != 0
+        || jobs[1].out.len != 1000000 || jobs[2].status == 0)
+        bad++;
+    if (!bad) {
+        printf("✅ Runner Test 1 PASSED: %d outputs and statuses matched\n", JOBS);
+    } else {
+        printf("❌ Runner Test 1 FAILED: %d jobs wrong (run %d)\n", bad, rc);
+    }
+
+    // Test 2: the slow job held up none of the others
+    if (rc == 0 && slowest < jobs[0].ns) {
+        printf("✅ Runner Test 2 PASSED: Fast jobs finished while the slow one ran\n");
+    } else {
+        printf("❌ Runner Test 2 FAILED: slowest echo %.1f ms, slow job %.1f ms\n",
+               slowest / 1e6, jobs[0].ns / 1e6);
+    }
+    printf("ℹ️  %d jobs, %zu bytes in %.1f ms: slow job %.1f ms, slowest echo %.1f ms\n",
+           JOBS, bytes, ms, jobs[0].ns / 1e6, slowest / 1e6);
+    for (int i = 0; i < JOBS; i++)
+        free(jobs[i].out.data);
+
+    int final_fd_count = count_open_fds();
+    if (final_fd_count <= initial_fd_count) {
+        printf("✅ Runner FD Test PASSED: No FD leaks\n");
+    } else {
+        printf("❌ Runner FD Test FAILED: FD leak detected (%d -> %d)\n",
+               initial_fd_count, final_fd_count);
+    }
+}
+
 void run_comprehensive_valgrind_test() {
     printf("\n=== COMPREHENSIVE VALGRIND ANALYSIS ===\n");
     printf("Running with flags: --leak-check=full --show-leak-kinds=all --track-origins=yes -s --track-fds=yes\n");
@@ -263,6 +646,11 @@ int main() {
     test_pipe_closure_on_errors();
     test_dup2_failure_simulation();
     test_stress_multiple_operations();
+    test_pclose_exact_child();
+    test_zygote_pool();
+    test_spawn_backend();
+    test_popen_rw();
+    test_popen_runner();
     run_comprehensive_valgrind_test();
     
     printf("\n🏁 Comprehensive testing completed!\n");
@@ -0,0 +1,546 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "vbc.h"
+
+// Benchmark: generates expressions of several shapes and runs every
+// evaluation strategy on each, timing parse, eval and free separately (best
+// of the runs) and reporting the arena's allocations. Each result is one
+// JSON object per line, or a CSV row with -c. speedup is relative to the
+// recursive strategy, the original parse_addition + eval_tree path. For the
+// incremental strategy, parse is building the tree and eval is one edit that
+// rewrites the middle digit in place. jit is compiled and run once, like
+// bytecode; the -hot strategies compile once as part of parse and report the
+// average of BENCH_HOT_CALLS calls as eval, the case of a hot expression.
+// Build with: cc -O2 -pthread bench_vbc.c vbc_*.c -o bench_vbc
+// Usage: bench_vbc [-c] [-n BYTES] [-r RUNS] [-s SEED] [WORKLOAD...]
+#define BENCH_STACK ((size_t)1 << 30)
+#define BENCH_HOT_CALLS 100
+
+typedef struct workload {
+    const char  *name;
+    char        *(*gen)(size_t n, uint64_t *seed);
+}   workload;
+
+typedef enum strategy {
+    S_RECURSIVE,
+    S_TREE,
+    S_SIMPLIFY,
+    S_DIRECT,
+    S_BYTECODE,
+    S_DAG,
+    S_PARALLEL,
+    S_POOL,
+    S_INCREMENTAL,
+    S_JIT,
+    S_BYTECODE_HOT,
+    S_JIT_HOT,
+    S_NARY,
+    S_COUNT
+}   strategy;
+
+static const char   *g_strategies[S_COUNT] = {
+    "recursive", "tree", "simplify", "direct", "bytecode", "dag", "parallel",
+    "pool", "incremental", "jit", "bytecode-hot", "jit-hot", "nary"
+};
+
+typedef struct result {
+    uint64_t    parse;
+    uint64_t    eval;
+    uint64_t    free;
+    size_t      nodes;
+    size_t      mallocs;
+    size_t      bytes;
+    int         value;
+    vbc_status  code;
+}   result;
+
+typedef struct options {
+    size_t      size;
+    int         runs;
+    uint64_t    seed;
+    int         csv;
+    char        **names;
+    int         nnames;
+}   options;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+static uint64_t next_rand(uint64_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return (*x);
+}
+
+static char     digit(uint64_t *seed)
+{
+    return ((char)('1' + next_rand(seed) % 9));
+}
+
+// "1+2+3+..." of about n bytes.
+static char     *gen_chain(size_t n, uint64_t *seed, char op)
+{
+    char    *s;
+    size_t  i;
+
+    s = malloc(n + 2);
+    if (!s)
+        return (NULL);
+    i = 0;
+    s[i++] = digit(seed);
+    while (i + 2 <= n)
+    {
+        s[i++] = op;
+        s[i++] = digit(seed);
+    }
+    s[i] = '\0';
+    return (s);
+}
+
+static char     *gen_sum(size_t n, uint64_t *seed)
+{
+    return (gen_chain(n, seed, '+'));
+}
+
+static char     *gen_product(size_t n, uint64_t *seed)
+{
+    return (gen_chain(n, seed, '*'));
+}
+
+// "1+(2*(3+(...)))": nesting depth about n / 4.
+static char     *gen_deep(size_t n, uint64_t *seed)
+{
+    char    *s;
+    size_t  depth;
+    size_t  i;
+    size_t  k;
+
+    depth = n / 4 ? n / 4 : 1;
+    s = malloc(4 * depth + 2);
+    if (!s)
+        return (NULL);
+    i = 0;
+    k = 0;
+    while (k < depth)
+    {
+        s[i++] = digit(seed);
+        s[i++] = k++ % 2 ? '*' : '+';
+        s[i++] = '(';
+    }
+    s[i++] = digit(seed);
+    while (k--)
+        s[i++] = ')';
+    s[i] = '\0';
+    return (s);
+}
+
+// Random operators, digits and groups nested at most 64 deep.
+static char     *gen_random(size_t n, uint64_t *seed)
+{
+    char    *s;
+    size_t  depth;
+    size_t  i;
+
+    s = malloc(n + 3 * 64 + 2);
+    if (!s)
+        return (NULL);
+    depth = 0;
+    i = 0;
+    while (1)
+    {
+        while (depth < 64 && next_rand(seed) % 4 == 0)
+        {
+            s[i++] = '(';
+            depth++;
+        }
+        s[i++] = digit(seed);
+        while (depth && next_rand(seed) % 4 == 0)
+        {
+            s[i++] = ')';
+            depth--;
+        }
+        if (i >= n)
+            break ;
+        s[i++] = next_rand(seed) % 2 ? '+' : '*';
+    }
+    while (depth--)
+        s[i++] = ')';
+    s[i] = '\0';
+    return (s);
+}
+
+// "((t+t)*(t+t))..." built by doubling, so the tree has about n nodes but
+// only a logarithmic number of distinct subtrees.
+static char     *gen_repeated(size_t n, uint64_t *seed)
+{
+    char    *s;
+    char    *t;
+    size_t  len;
+    int     level;
+
+    s = strdup("(1+2*3)");
+    if (!s)
+        return (NULL);
+    (void)seed;
+    len = strlen(s);
+    level = 0;
+    while (2 * len + 3 <= n)
+    {
+        t = malloc(2 * len + 4);
+        if (!t)
+            return (free(s), NULL);
+        t[0] = '(';
+        memcpy(t + 1, s, len);
+        t[len + 1] = level++ % 2 ? '*' : '+';
+        memcpy(t + len + 2, s, len);
+        t[2 * len + 2] = ')';
+        t[2 * len + 3] = '\0';
+        free(s);
+        s = t;
+        len = 2 * len + 3;
+    }
+    return (s);
+}
+
+static const workload   g_workloads[] = {
+    {"deep", gen_deep},
+    {"sum", gen_sum},
+    {"product", gen_product},
+    {"random", gen_random},
+    {"repeated", gen_repeated},
+};
+
+static void     parse_with(const char *s, strategy st, vbc_build *b,
+                    node **root, vbc_error *err)
+{
+    if (st == S_RECURSIVE)
+        vbc_parse_recursive(s, b->a, root, err);
+    else
+        vbc_parse_ex(s, b, root, err);
+}
+
+static int      eval_with(const char *s, strategy st, const vbc_build *b,
+                    node *root, int *res)
+{
+    program     p;
+    vbc_jit     j;
+    vbc_error   err;
+    int         ok;
+
+    if (st == S_DIRECT)
+        return (vbc_eval_direct(s, res, &err) == VBC_OK);
+    if (st == S_DAG)
+        return (*res = eval_dag(b->a, root), 1);
+    if (st == S_PARALLEL)
+        return (eval_parallel(root, (int)sysconf(_SC_NPROCESSORS_ONLN),
+                VBC_PAR_CUTOFF, res));
+    if (st == S_JIT)
+    {
+        ok = jit_compile(root, &j) != -1 && jit_call(&j, NULL, res);
+        jit_free(&j);
+        return (ok);
+    }
+    if (st != S_BYTECODE)
+        return (*res = eval_tree(root), 1);
+    ok = compile_tree(root, &p) && run_program(&p, res);
+    free_program(&p);
+    return (ok);
+}
+
+static void     keep_best(result *r, const uint64_t *t)
+{
+    if (!r->parse || t[1] - t[0] < r->parse)
+        r->parse = t[1] - t[0];
+    if (!r->eval || t[2] - t[1] < r->eval)
+        r->eval = t[2] - t[1];
+    if (!r->free || t[3] - t[2] < r->free)
+        r->free = t[3] - t[2];
+}
+
+static void     bench_pool(const char *s, result *r)
+{
+    node_pool   p;
+    vbc_error   err;
+    uint64_t    ts[4];
+
+    pool_init(&p);
+    ts[0] = now_ns();
+    pool_parse(s, &p, &err);
+    ts[1] = now_ns();
+    if (err.code == VBC_OK && !pool_eval(&p, &r->value))
+        err.code = VBC_ENOMEM;
+    ts[2] = now_ns();
+    r->nodes = p.n;
+    r->mallocs = 0;
+    while (p.cap >> r->mallocs > 1024)
+        r->mallocs++;
+    r->mallocs = 3 * (r->mallocs + 1);
+    r->bytes = (size_t)p.cap * (1 + 2 * sizeof(uint32_t));
+    pool_destroy(&p);
+    ts[3] = now_ns();
+    r->code = err.code;
+    keep_best(r, ts);
+}
+
+static void     bench_nary(const char *s, result *r)
+{
+    nary_tree   t;
+    vbc_error   err;
+    uint64_t    ts[4];
+
+    nary_init(&t);
+    ts[0] = now_ns();
+    nary_parse(s, &t, &err);
+    ts[1] = now_ns();
+    if (err.code == VBC_OK)
+        r->value = nary_eval(&t);
+    ts[2] = now_ns();
+    r->nodes = t.len;
+    r->mallocs = 4;
+    r->bytes = t.cap * (1 + 2 * sizeof(uint32_t) + sizeof(unsigned int));
+    nary_destroy(&t);
+    ts[3] = now_ns();
+    r->code = err.code;
+    keep_best(r, ts);
+}
+
+// The tree is released once compiled, except for a JIT fallback.
+static void     bench_hot(const char *s, strategy st, result *r)
+{
+    arena       a;
+    vbc_error   err;
+    node        *root;
+    program     p;
+    vbc_jit     j;
+    uint64_t    ts[4];
+    uint64_t    t;
+    int         i;
+
+    arena_init(&a);
+    p.code = NULL;
+    j.code = NULL;
+    j.prog.code = NULL;
+    j.size = 0;
+    ts[0] = now_ns();
+    if (vbc_parse(s, &a, &root, &err) == VBC_OK && (st == S_JIT_HOT
+            ? jit_compile(root, &j) != -1 : compile_tree(root, &p)) == 0)
+        err.code = VBC_ENOMEM;
+    ts[1] = now_ns();
+    i = 0;
+    while (err.code == VBC_OK && i++ < BENCH_HOT_CALLS)
+        if (st == S_JIT_HOT ? !jit_call(&j, NULL, &r->value)
+            : !run_program(&p, &r->value))
+            err.code = VBC_ENOMEM;
+    t = now_ns();
+    ts[2] = ts[1] + (t - ts[1]) / BENCH_HOT_CALLS;
+    r->nodes = a.nodes;
+    r->mallocs = a.blocks + 1;
+    r->bytes = a.bytes + (st == S_JIT_HOT ? j.size : p.len * sizeof(insn));
+    jit_free(&j);
+    free_program(&p);
+    arena_release(&a);
+    ts[3] = ts[2] + (now_ns() - t);
+    r->code = err.code;
+    keep_best(r, ts);
+}
+
+static void     bench_incr(const char *s, result *r)
+{
+    vbc_incr    t;
+    vbc_error   err;
+    char        d[2];
+    size_t      i;
+    uint64_t    ts[4];
+
+    i = strlen(s) / 2;
+    while (s[i] && (s[i] < '0' || s[i] > '9'))
+        i++;
+    d[0] = s[i];
+    d[1] = '\0';
+    ts[0] = now_ns();
+    incr_init(&t, s, &err);
+    ts[1] = now_ns();
+    if (err.code == VBC_OK && d[0])
+        incr_edit(&t, i, 1, d, &err);
+    ts[2] = now_ns();
+    r->nodes = t.nodes;
+    r->mallocs = t.blocks;
+    r->bytes = t.blocks * (sizeof(void *) + INCR_SLAB * sizeof(inode));
+    r->value = incr_value(&t);
+    incr_free(&t);
+    ts[3] = now_ns();
+    r->code = err.code;
+    keep_best(r, ts);
+}
+
+static void     bench_once(const char *s, strategy st, result *r)
+{
+    arena       a;
+    hashcons    h;
+    vbc_build   b;
+    vbc_error   err;
+    node        *root;
+    uint64_t    t[4];
+
+    if (st == S_POOL)
+        return (bench_pool(s, r));
+    if (st == S_NARY)
+        return (bench_nary(s, r));
+    if (st == S_BYTECODE_HOT || st == S_JIT_HOT)
+        return (bench_hot(s, st, r));
+    if (st == S_INCREMENTAL)
+        return (bench_incr(s, r));
+    arena_init(&a);
+    b.a = &a;
+    b.dag = st == S_DAG ? &h : NULL;
+    b.flags = st == S_SIMPLIFY ? VBC_SIMPLIFY : 0;
+    if (st == S_DAG && !hashcons_init(&h))
+    {
+        r->code = VBC_ENOMEM;
+        return ;
+    }
+    err.code = VBC_OK;
+    t[0] = now_ns();
+    if (st != S_DIRECT)
+        parse_with(s, st, &b, &root, &err);
+    t[1] = now_ns();
+    if (err.code == VBC_OK && !eval_with(s, st, &b, root, &r->value))
+        err.code = VBC_ENOMEM;
+    t[2] = now_ns();
+    r->nodes = a.nodes;
+    r->mallocs = a.blocks + (st == S_DAG);
+    r->bytes = a.bytes + (st == S_DAG ? h.cap * sizeof(node *) : 0);
+    arena_release(&a);
+    if (st == S_DAG)
+        hashcons_free(&h);
+    t[3] = now_ns();
+    r->code = err.code;
+    keep_best(r, t);
+}
+
+static void     report(const options *o, const char *name, size_t len,
+                    strategy st, const result *r, double speedup)
+{
+    const char  *fmt;
+
+    if (o->csv)
+        fmt = "%s,%zu,%s,%d,%llu,%llu,%llu,%zu,%zu,%zu,%d,%.3f,%s\n";
+    else
+        fmt = "{\"workload\":\"%s\",\"input_bytes\":%zu,\"strategy\":\"%s\","
+            "\"runs\":%d,\"parse_ns\":%llu,\"eval_ns\":%llu,\"free_ns\":%llu,"
+            "\"nodes\":%zu,\"mallocs\":%zu,\"bytes\":%zu,\"result\":%d,"
+            "\"speedup\":%.3f,\"status\":\"%s\"}\n";
+    printf(fmt, name, len, g_strategies[st], o->runs,
+        (unsigned long long)r->parse, (unsigned long long)r->eval,
+        (unsigned long long)r->free, r->nodes, r->mallocs, r->bytes,
+        r->value, speedup, r->code == VBC_OK ? "ok" : "error");
+}
+
+static int      selected(const options *o, const char *name)
+{
+    int i;
+
+    if (!o->nnames)
+        return (1);
+    i = 0;
+    while (i < o->nnames)
+        if (!strcmp(o->names[i++], name))
+            return (1);
+    return (0);
+}
+
+// Runs on a thread with a BENCH_STACK stack: the recursive parser and
+// eval_tree need one frame per level of the deepest inputs.
+static void     *bench_main(void *arg)
+{
+    options     *o;
+    result      r;
+    uint64_t    base;
+    uint64_t    seed;
+    char        *s;
+    size_t      w;
+    int         st;
+    int         i;
+
+    o = arg;
+    if (o->csv)
+        printf("workload,input_bytes,strategy,runs,parse_ns,eval_ns,free_ns,"
+            "nodes,mallocs,bytes,result,speedup,status\n");
+    w = 0;
+    while (w < sizeof(g_workloads) / sizeof(*g_workloads))
+    {
+        seed = o->seed;
+        s = selected(o, g_workloads[w].name)
+            ? g_workloads[w].gen(o->size, &seed) : NULL;
+        base = 0;
+        st = 0;
+        while (s && st < S_COUNT)
+        {
+            memset(&r, 0, sizeof(r));
+            i = 0;
+            while (i++ < o->runs)
+                bench_once(s, (strategy)st, &r);
+            if (st == S_RECURSIVE)
+                base = r.parse + r.eval + r.free;
+            report(o, g_workloads[w].name, strlen(s), (strategy)st, &r,
+                (double)base / (r.parse + r.eval + r.free + !base));
+            st++;
+        }
+        fflush(stdout);
+        free(s);
+        w++;
+    }
+    return (NULL);
+}
+
+int main(int argc, char **argv)
+{
+    options         o;
+    pthread_attr_t  attr;
+    pthread_t       th;
+    int             i;
+
+    o.size = 1 << 20;
+    o.runs = 5;
+    o.seed = 42;
+    o.csv = 0;
+    i = 1;
+    while (i < argc && argv[i][0] == '-' && argv[i][1] && !argv[i][2])
+    {
+        if (argv[i][1] == 'c')
+            o.csv = 1;
+        else if (argv[i][1] == 'n' && i + 1 < argc)
+            o.size = strtoul(argv[++i], NULL, 10);
+        else if (argv[i][1] == 'r' && i + 1 < argc)
+            o.runs = atoi(argv[++i]);
+        else if (argv[i][1] == 's' && i + 1 < argc)
+            o.seed = strtoull(argv[++i], NULL, 10);
+        else
+            return (fprintf(stderr, "usage: bench_vbc [-c] [-n BYTES] "
+                    "[-r RUNS] [-s SEED] [WORKLOAD...]\n"), 1);
+        i++;
+    }
+    if (o.runs < 1 || !o.seed)
+        return (1);
+    o.names = argv + i;
+    o.nnames = argc - i;
+    pthread_attr_init(&attr);
+    if (pthread_attr_setstacksize(&attr, BENCH_STACK)
+        || pthread_create(&th, &attr, bench_main, &o))
+        return (1);
+    pthread_join(th, NULL);
+    pthread_attr_destroy(&attr);
+    return (0);
+}
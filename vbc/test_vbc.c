@@ -0,0 +1,1444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "vbc.h"
+
+// Tests: every evaluation mode against the expected value and the error
+// message of a few expressions, with and without variables, the arena, the
+// DAG, the pool and the simplifier by node count, then columns and
+// incremental edits against a fresh evaluation of the same text, then batch
+// mode and a server in child processes. Prints each failed check and exits
+// with 1 if there was one.
+// Build with: cc -pthread test_vbc.c vbc_*.c -o test_vbc
+
+typedef struct mode_case {
+    const char  *name;
+    vbc_mode    mode;
+    int         vars;   // parses with vbc_parse_ex, so VBC_VARS applies
+}   mode_case;
+
+static const mode_case  g_modes[] = {
+    {"tree", VBC_TREE, 1},
+    {"recursive", VBC_RECURSIVE, 0},
+    {"direct", VBC_DIRECT, 0},
+    {"bytecode", VBC_BYTECODE, 1},
+    {"dag", VBC_DAG, 1},
+    {"parallel", VBC_PARALLEL, 1},
+    {"pool", VBC_POOL, 0},
+    {"jit", VBC_JIT, 1},
+    {"nary", VBC_NARY, 0}
+};
+
+static int  g_checks;
+static int  g_failed;
+
+static void check(int ok, const char *what, const char *detail)
+{
+    g_checks++;
+    if (ok)
+        return ;
+    g_failed++;
+    printf("FAIL: %s: %.60s\n", what, detail);
+}
+
+// Variables read as 0 in vbc_eval; modes without them reject the first one.
+static void test_expr(const char *s, int flags, int want)
+{
+    arena       a;
+    vbc_error   err;
+    size_t      i;
+    int         res;
+    int         ok;
+
+    arena_init(&a);
+    i = 0;
+    while (i < sizeof(g_modes) / sizeof(*g_modes))
+    {
+        res = ~want;
+        vbc_eval(s, g_modes[i].mode, flags, &a, &res, &err);
+        if ((flags & VBC_VARS) && !g_modes[i].vars)
+            ok = err.code == VBC_EUNEXPECTED
+                && s[err.pos] >= 'a' && s[err.pos] <= 'z';
+        else
+            ok = err.code == VBC_OK && res == want;
+        check(ok, g_modes[i].name, s);
+        i++;
+    }
+    arena_release(&a);
+}
+
+// "a+a+...+a+1" with n variables: deep enough to be split across threads.
+static char *var_chain(size_t n)
+{
+    char    *s;
+    size_t  i;
+
+    s = malloc(2 * n + 2);
+    if (!s)
+        return (NULL);
+    i = 0;
+    while (i < n)
+    {
+        s[2 * i] = 'a' + i % 26;
+        s[2 * i++ + 1] = '+';
+    }
+    s[2 * n] = '1';
+    s[2 * n + 1] = '\0';
+    return (s);
+}
+
+// "(1+(1+...(1+1)*2...)*2)*2" nested n deep, and its value.
+static char *deep_line(size_t n, int *want)
+{
+    unsigned int    v;
+    char            *s;
+    size_t          i;
+
+    s = malloc(6 * n + 2);
+    if (!s)
+        return (NULL);
+    v = 1;
+    i = 0;
+    while (i < n)
+    {
+        memcpy(s + 3 * i, "(1+", 3);
+        memcpy(s + 3 * n + 1 + 3 * i++, ")*2", 3);
+        v = (1 + v) * 2;
+    }
+    s[3 * n] = '1';
+    s[6 * n + 1] = '\0';
+    *want = (int)v;
+    return (s);
+}
+
+// "1+1+...+1" with n ones.
+static char *ones(size_t n)
+{
+    char    *s;
+    size_t  i;
+
+    s = malloc(2 * n);
+    if (!s)
+        return (NULL);
+    i = 0;
+    while (i < n)
+    {
+        s[2 * i] = '1';
+        s[2 * i++ + 1] = '+';
+    }
+    s[2 * n - 1] = '\0';
+    return (s);
+}
+
+// The counts -S prints: one node per leaf and operator, blocks doubling from
+// 64 nodes, none allocated again once the arena is warm, and marks giving
+// back exactly what came after them.
+static void test_arena(void)
+{
+    arena       a;
+    arena_mark  m;
+    vbc_error   err;
+    node        tmp;
+    node        *first;
+    char        *s;
+    size_t      blocks;
+    int         res;
+    int         i;
+
+    arena_init(&a);
+    vbc_eval("2*(3+4)+5*6*7", VBC_TREE, 0, &a, &res, &err);
+    check(err.code == VBC_OK && a.nodes == 11 && a.blocks == 1
+        && a.bytes == sizeof(arena_block) + 64 * sizeof(node), "arena",
+        "11 nodes");
+    s = ones(1000);
+    if (s)
+    {
+        vbc_eval(s, VBC_TREE, 0, &a, &res, &err);
+        check(err.code == VBC_OK && res == 1000 && a.nodes == 1999
+            && a.blocks == 6 && a.bytes == 6 * sizeof(arena_block)
+            + (64 + 128 + 256 + 512 + 1024 + 2048) * sizeof(node), "arena",
+            "1999 nodes in 6 blocks");
+        blocks = a.blocks;
+        vbc_eval(s, VBC_TREE, 0, &a, &res, &err);
+        check(err.code == VBC_OK && a.nodes == 1999 && a.blocks == blocks,
+            "arena", "warm arena");
+    }
+    free(s);
+    arena_release(&a);
+    check(a.nodes == 0 && a.blocks == 0 && !a.head, "arena", "release");
+    tmp.type = VAL;
+    tmp.val = 0;
+    tmp.l = NULL;
+    tmp.r = NULL;
+    m = arena_get_mark(&a);
+    first = new_node(&a, tmp);
+    arena_rewind(&a, m);
+    check(a.nodes == 0 && new_node(&a, tmp) == first, "arena",
+        "rewind to an empty arena");
+    i = 0;
+    while (i++ < 99)
+        new_node(&a, tmp);
+    m = arena_get_mark(&a);
+    first = new_node(&a, tmp);
+    i = 0;
+    while (i++ < 199)
+        new_node(&a, tmp);
+    blocks = a.blocks;
+    arena_rewind(&a, m);
+    check(a.nodes == 100 && new_node(&a, tmp) == first, "arena",
+        "rewind across blocks");
+    i = 0;
+    while (i++ < 199)
+        new_node(&a, tmp);
+    check(a.nodes == 300 && a.blocks == blocks, "arena",
+        "blocks kept after a rewind");
+    arena_release(&a);
+}
+
+static void dag_case(const char *s, int flags, int want, size_t unique,
+                size_t requests)
+{
+    arena       a;
+    hashcons    h;
+    vbc_error   err;
+    int         res;
+
+    arena_init(&a);
+    if (!hashcons_init(&h))
+        return ;
+    res = ~want;
+    vbc_eval_dag(s, flags, &a, &h, &res, &err);
+    check(err.code == VBC_OK && res == want && h.unique == unique
+        && h.requests == requests && a.nodes == unique, "dag", s);
+    hashcons_free(&h);
+    arena_release(&a);
+}
+
+// The sharing -S reports under -D: each distinct subtree is made once, its
+// children compared by pointer, and the table grows past its first size.
+static void test_dag(void)
+{
+    arena       a;
+    hashcons    h;
+    vbc_error   err;
+    char        *s;
+    int         res;
+
+    dag_case("(1+2)*(1+2)", 0, 9, 4, 7);
+    dag_case("(1+2)*(2+1)", 0, 9, 5, 7);
+    dag_case("1+1+1+1", 0, 4, 4, 7);
+    dag_case("a*b+b*a+a*b", VBC_VARS, 0, 6, 11);
+    s = ones(100000);
+    if (!s)
+        return ;
+    arena_init(&a);
+    if (hashcons_init(&h))
+    {
+        vbc_eval_dag(s, 0, &a, &h, &res, &err);
+        vbc_eval_dag(s, 0, &a, &h, &res, &err);
+        check(err.code == VBC_OK && res == 100000 && h.unique == 100000
+            && h.requests == 199999 && a.nodes == 100000
+            && h.cap >= 100000 && !(h.cap & (h.cap - 1)), "dag",
+            "100000 unique nodes, twice");
+        hashcons_free(&h);
+    }
+    arena_release(&a);
+    free(s);
+}
+
+// The arrays hold the tree in postorder, a VAL's digit in l, and grow by
+// doubling from 1024 nodes; a reused pool starts empty.
+static void test_pool(void)
+{
+    static const char       types[] = {VAL, VAL, VAL, ADD, MULTI, VAL, VAL,
+        MULTI, VAL, MULTI, ADD};
+    static const uint32_t   l[] = {2, 3, 4, 1, 0, 5, 6, 5, 7, 7, 4};
+    static const uint32_t   r[] = {0, 0, 0, 2, 3, 0, 0, 6, 0, 8, 9};
+    node_pool               p;
+    vbc_error               err;
+    char                    *s;
+    uint32_t                i;
+    int                     ok;
+    int                     res;
+
+    pool_init(&p);
+    ok = pool_parse("2*(3+4)+5*6*7", &p, &err) == VBC_OK && p.n == 11
+        && p.root == 10 && p.depth == 3 && pool_eval(&p, &res) && res == 224;
+    i = 0;
+    while (ok && i < 11)
+    {
+        ok = p.type[i] == types[i] && p.l[i] == l[i]
+            && (types[i] == VAL || p.r[i] == r[i]);
+        i++;
+    }
+    check(ok, "pool", "2*(3+4)+5*6*7 in postorder");
+    s = ones(3000);
+    if (s)
+        check(pool_parse(s, &p, &err) == VBC_OK && p.n == 5999
+            && p.cap == 8192 && p.root == 5998 && p.depth == 2
+            && pool_eval(&p, &res) && res == 3000, "pool",
+            "5999 nodes in a reused pool");
+    free(s);
+    pool_destroy(&p);
+}
+
+// Postfix order, the stack depth, variables bound or read as 0, a program
+// run after its arena is gone, and one deeper than run_bound's own stack.
+static void test_bytecode(void)
+{
+    static const insn   want[] = {{OP_PUSH, 2}, {OP_PUSH, 3}, {OP_PUSH, 4},
+        {OP_ADD, 0}, {OP_MUL, 0}, {OP_VAR, 0}, {OP_VAR, 1}, {OP_MUL, 0},
+        {OP_ADD, 0}};
+    arena               a;
+    vbc_build           b;
+    vbc_error           err;
+    program             p;
+    node                *tree;
+    char                *s;
+    int                 vars[2];
+    int                 res[2];
+    int                 ok;
+    int                 v;
+    size_t              i;
+
+    arena_init(&a);
+    b.a = &a;
+    b.dag = NULL;
+    b.flags = VBC_VARS;
+    p.code = NULL;
+    ok = vbc_parse_ex("2*(3+4)+a*b", &b, &tree, &err) == VBC_OK
+        && compile_tree(tree, &p) && p.len == 9 && p.depth == 3;
+    arena_release(&a);
+    i = 0;
+    while (ok && i < 9)
+    {
+        ok = p.code[i].op == want[i].op && p.code[i].arg == want[i].arg;
+        i++;
+    }
+    vars[0] = 5;
+    vars[1] = -6;
+    check(ok && run_bound(&p, vars, &res[0]) && run_program(&p, &res[1])
+        && res[0] == -16 && res[1] == 14, "bytecode", "2*(3+4)+a*b");
+    free_program(&p);
+    s = deep_line(1000, &v);
+    b.flags = 0;
+    ok = s && vbc_parse_ex(s, &b, &tree, &err) == VBC_OK
+        && compile_tree(tree, &p);
+    check(ok && p.len == 4001 && p.depth > 256 && run_program(&p, &res[0])
+        && res[0] == v, "bytecode", "1000 deep");
+    if (ok)
+        free_program(&p);
+    arena_release(&a);
+    free(s);
+}
+
+// Every mode but the two that recurse over the tree.
+static void test_deep(void)
+{
+    arena       a;
+    vbc_error   err;
+    char        *s;
+    size_t      i;
+    int         want;
+    int         res;
+
+    s = deep_line(1000000, &want);
+    if (!s)
+        return ;
+    arena_init(&a);
+    i = 0;
+    while (i < sizeof(g_modes) / sizeof(*g_modes))
+    {
+        res = ~want;
+        if (g_modes[i].mode != VBC_TREE && g_modes[i].mode != VBC_RECURSIVE)
+        {
+            vbc_eval(s, g_modes[i].mode, 0, &a, &res, &err);
+            check(err.code == VBC_OK && res == want, g_modes[i].name,
+                "1000000 deep");
+        }
+        i++;
+    }
+    arena_release(&a);
+    free(s);
+}
+
+static void test_modes(void)
+{
+    unsigned int    p;
+    char            *s;
+    int             i;
+
+    test_expr("2*(3+4)+5*6*7", 0, 224);
+    test_expr("((((7))))", 0, 7);
+    p = 1;
+    i = 0;
+    while (i++ < 11)
+        p *= 9;
+    test_expr("9*9*9*9*9*9*9*9*9*9*9", 0, (int)p);
+    test_expr("a+b*c", VBC_VARS, 0);
+    test_expr("c*(b+9)+a", VBC_VARS, 0);
+    test_expr("(a+1)*(a+1)+b*2", VBC_VARS | VBC_SIMPLIFY, 1);
+    s = var_chain(4 * VBC_PAR_CUTOFF);
+    if (s)
+        test_expr(s, VBC_VARS, 1);
+    free(s);
+}
+
+// Parses s with and without VBC_SIMPLIFY: the simplified tree has the same
+// value for any variables and takes exactly nodes nodes of its arena.
+static void simplify_case(const char *s, size_t nodes)
+{
+    arena       a[2];
+    vbc_build   b;
+    vbc_error   err;
+    node        *tree[2];
+    int         vars[26];
+    int         i;
+
+    i = 0;
+    while (i < 26)
+    {
+        vars[i] = 7 * i - 50;
+        i++;
+    }
+    b.dag = NULL;
+    i = 0;
+    while (i < 2)
+    {
+        arena_init(&a[i]);
+        b.a = &a[i];
+        b.flags = VBC_VARS | (i ? VBC_SIMPLIFY : 0);
+        if (vbc_parse_ex(s, &b, &tree[i], &err) != VBC_OK)
+            tree[i] = NULL;
+        i++;
+    }
+    check(tree[0] && tree[1] && a[1].nodes == nodes
+        && eval_bound(tree[1], vars) == eval_bound(tree[0], vars),
+        "simplify", s);
+    arena_release(&a[0]);
+    arena_release(&a[1]);
+}
+
+static void test_simplify(void)
+{
+    simplify_case("2*3+4", 1);
+    simplify_case("9*9*9*9*9*9*9*9*9*9*9", 1);
+    simplify_case("a*0", 1);
+    simplify_case("0*(a+b)", 1);
+    simplify_case("a*1", 1);
+    simplify_case("(a+b)+0", 3);
+    simplify_case("1*a", 1);
+    simplify_case("0+a", 1);
+    simplify_case("1*(a+b)", 3);
+    simplify_case("0+a*b*c", 5);
+    simplify_case("1*(1*(0+(1*a)))", 1);
+    simplify_case("(0+a)*(1*b)+(c*1)*(1*1)", 5);
+    simplify_case("a*(2+3)+0*b", 3);
+}
+
+// Feeds len bytes of s to vbc_eval_fd through a pipe.
+static void stream(const char *s, size_t len, vbc_status code, size_t pos,
+                const char *msg)
+{
+    vbc_error   err;
+    char        buf[64];
+    int         fd[2];
+    int         res;
+    int         ok;
+
+    if (pipe(fd) == -1)
+        return ;
+    ok = write(fd[1], s, len) == (ssize_t)len;
+    close(fd[1]);
+    vbc_eval_fd(fd[0], &res, &err);
+    close(fd[0]);
+    vbc_strerror(&err, buf, sizeof(buf));
+    check(ok && err.code == code && (code == VBC_OK || err.pos == pos)
+        && strcmp(buf, msg) == 0, "stream", buf);
+}
+
+static void test_stream(void)
+{
+    stream("1+2*3\n", 6, VBC_OK, 0, "OK");
+    stream("1+2*3", 5, VBC_OK, 0, "OK");
+    stream("1+2\0+3", 6, VBC_EUNEXPECTED, 3, "Unexpected token '\\0'");
+    stream("1+2\n\n", 5, VBC_EUNEXPECTED, 3, "Unexpected token '\\n'");
+    stream("1+2\n+3", 6, VBC_EUNEXPECTED, 3, "Unexpected token '\\n'");
+    stream("1+\x7f", 3, VBC_EUNEXPECTED, 2, "Unexpected token '\\x7f'");
+    stream("(1+2", 4, VBC_EEND, 4, "Unexpected end of input");
+}
+
+// Every parser reports the same error: a ')' that closes nothing first,
+// wherever it is, then the first offending byte.
+static void test_error(const char *s, size_t pos, const char *msg)
+{
+    const int   *cols[VBC_NVARS];
+    arena       a;
+    vbc_error   err;
+    vbc_incr    t;
+    char        buf[64];
+    size_t      i;
+    int         out;
+
+    arena_init(&a);
+    i = 0;
+    while (i < sizeof(g_modes) / sizeof(*g_modes))
+    {
+        vbc_eval(s, g_modes[i].mode, 0, &a, &out, &err);
+        vbc_strerror(&err, buf, sizeof(buf));
+        check(err.code != VBC_OK && err.pos == pos && strcmp(buf, msg) == 0,
+            g_modes[i].name, s);
+        i++;
+    }
+    arena_release(&a);
+    memset(cols, 0, sizeof(cols));
+    vbc_eval_columns(s, cols, 1, &out, &err);
+    vbc_strerror(&err, buf, sizeof(buf));
+    check(err.pos == pos && strcmp(buf, msg) == 0, "columns", s);
+    incr_init(&t, s, &err);
+    incr_free(&t);
+    vbc_strerror(&err, buf, sizeof(buf));
+    check(err.pos == pos && strcmp(buf, msg) == 0, "incremental", s);
+    stream(s, strlen(s), err.code, pos, msg);
+}
+
+static void test_errors(void)
+{
+    test_error("1++)", 3, "Unexpected token ')'");
+    test_error("x)", 1, "Unexpected token ')'");
+    test_error(")", 0, "Unexpected token ')'");
+    test_error("1)+(2", 1, "Unexpected token ')'");
+    test_error("2*(3+4))+(", 7, "Unexpected token ')'");
+    test_error("(1+x)", 3, "Unexpected token 'x'");
+    test_error("1++2", 2, "Unexpected token '+'");
+    test_error("(()", 2, "Unexpected token ')'");
+    test_error("1 +2", 1, "Unexpected token ' '");
+    test_error("(1+2", 4, "Unexpected end of input");
+    test_error("1+", 2, "Unexpected end of input");
+    test_error("", 0, "Unexpected end of input");
+}
+
+typedef struct par_case {
+    const node  *tree;
+    int         want;
+    int         nthreads;
+    int         ok;
+}   par_case;
+
+static void *par_loop(void *arg)
+{
+    par_case    *c;
+    int         res;
+    int         i;
+
+    c = arg;
+    c->ok = 1;
+    i = 0;
+    while (i++ < 5)
+        c->ok &= eval_parallel(c->tree, c->nthreads, 64, &res)
+            && res == c->want;
+    return (NULL);
+}
+
+// Calls eval_parallel directly, since vbc_eval asks for one thread per CPU:
+// the pool is started once and reused with fewer threads, and calls from two
+// threads at once share it.
+static void test_parallel(void)
+{
+    arena       a;
+    vbc_error   err;
+    node        *tree;
+    program     p;
+    par_case    c[2];
+    pthread_t   th;
+    char        *s;
+    size_t      n;
+    size_t      i;
+
+    n = 100000;
+    s = malloc(6 * n);
+    if (!s)
+        return ;
+    i = 0;
+    while (i < n)
+    {
+        memcpy(s + 6 * i, i % 7 ? "(1+2)*" : "3*4+5+", 6);
+        s[6 * i + (i % 7 != 0)] = '1' + i % 9;
+        i++;
+    }
+    s[6 * n - 1] = '\0';
+    arena_init(&a);
+    p.code = NULL;
+    if (vbc_parse(s, &a, &tree, &err) != VBC_OK || !compile_tree(tree, &p)
+        || !run_program(&p, &c[0].want))
+        tree = NULL;
+    free_program(&p);
+    free(s);
+    check(tree != NULL, "parallel", "parse");
+    if (!tree)
+    {
+        arena_release(&a);
+        return ;
+    }
+    c[0].tree = tree;
+    c[1] = c[0];
+    c[0].nthreads = 4;
+    c[1].nthreads = 2;
+    par_loop(&c[0]);
+    check(c[0].ok, "parallel", "4 threads");
+    par_loop(&c[1]);
+    check(c[1].ok, "parallel", "2 threads");
+    if (pthread_create(&th, NULL, par_loop, &c[1]) == 0)
+    {
+        par_loop(&c[0]);
+        pthread_join(th, NULL);
+        check(c[0].ok && c[1].ok, "parallel", "two callers");
+    }
+    arena_release(&a);
+}
+
+// Each thread evaluates in every mode with its own arena, so nothing but
+// the library's own state is shared.
+static void *reentrant_loop(void *arg)
+{
+    static const char   *exprs[] = {"2*(3+4)+5*6*7", "((((7))))", "1++2",
+        "(1+2"};
+    static const int    want[] = {224, 7};
+    arena               a;
+    vbc_error           err;
+    size_t              i;
+    int                 *ok;
+    int                 res;
+    int                 n;
+
+    ok = arg;
+    *ok = 1;
+    arena_init(&a);
+    n = 0;
+    while (n < 200)
+    {
+        i = n % (sizeof(g_modes) / sizeof(*g_modes));
+        vbc_eval(exprs[n % 4], g_modes[i].mode, 0, &a, &res, &err);
+        if (n % 4 < 2)
+            *ok &= err.code == VBC_OK && res == want[n % 4];
+        else
+            *ok &= err.code == (n % 4 == 2 ? VBC_EUNEXPECTED : VBC_EEND)
+                && err.pos == (n % 4 == 2 ? 2 : 4);
+        n++;
+    }
+    arena_release(&a);
+    return (NULL);
+}
+
+static void test_reentrant(void)
+{
+    pthread_t   th[4];
+    int         ok[4];
+    int         n;
+    int         i;
+
+    n = 0;
+    while (n < 4 && pthread_create(&th[n], NULL, reentrant_loop, &ok[n]) == 0)
+        n++;
+    i = 0;
+    while (i < n)
+        pthread_join(th[i++], NULL);
+    while (n-- > 0)
+        check(ok[n], "reentrant", "four threads in every mode");
+}
+
+// Reference bignums for eval_big: little-endian 32-bit limbs, trimmed,
+// multiplied by schoolbook only. Memory failures are not handled.
+typedef struct ref_num {
+    uint32_t    *d;
+    size_t      n;
+}   ref_num;
+
+static ref_num  ref_trim(uint32_t *d, size_t n)
+{
+    ref_num r;
+
+    while (n && !d[n - 1])
+        n--;
+    r.d = d;
+    r.n = n;
+    return (r);
+}
+
+static ref_num  ref_op(ref_num a, ref_num b, char op)
+{
+    uint64_t    c;
+    uint32_t    *d;
+    size_t      n;
+    size_t      i;
+    size_t      j;
+
+    n = op == '+' ? (a.n > b.n ? a.n : b.n) + 1 : a.n + b.n;
+    d = calloc(n + 1, sizeof(*d));
+    c = 0;
+    i = 0;
+    while (op == '+' && i < n)
+    {
+        c += (uint64_t)(i < a.n ? a.d[i] : 0) + (i < b.n ? b.d[i] : 0);
+        d[i++] = (uint32_t)c;
+        c >>= 32;
+    }
+    i = 0;
+    while (op == '*' && i < a.n)
+    {
+        c = 0;
+        j = 0;
+        while (j < b.n)
+        {
+            c += (uint64_t)a.d[i] * b.d[j] + d[i + j];
+            d[i + j++] = (uint32_t)c;
+            c >>= 32;
+        }
+        d[i++ + j] = (uint32_t)c;
+    }
+    free(a.d);
+    free(b.d);
+    return (ref_trim(d, n));
+}
+
+// Recursive descent straight over the text, which tests keep shallow.
+static ref_num  ref_eval(const char **s, int prec)
+{
+    ref_num v;
+    ref_num r;
+    char    op;
+
+    if (**s == '(')
+    {
+        (*s)++;
+        v = ref_eval(s, 0);
+        (*s)++;
+    }
+    else
+    {
+        v.d = malloc(sizeof(*v.d));
+        v.d[0] = (uint32_t)(*(*s)++ - '0');
+        v = ref_trim(v.d, 1);
+    }
+    while ((**s == '*' && prec < 2) || (**s == '+' && prec < 1))
+    {
+        op = *(*s)++;
+        r = ref_eval(s, op == '+' ? 1 : 2);
+        v = ref_op(v, r, op);
+    }
+    return (v);
+}
+
+// Checks eval_big against the reference, and its low 32 bits against
+// eval_tree.
+static void     big_case(const char *s, const char *what)
+{
+    arena       a;
+    vbc_error   err;
+    node        *tree;
+    vbc_num     res;
+    ref_num     want;
+    const char  *p;
+    uint64_t    small;
+    int         ok;
+
+    arena_init(&a);
+    p = s;
+    want = ref_eval(&p, 0);
+    ok = 0;
+    if (vbc_parse(s, &a, &tree, &err) == VBC_OK
+        && eval_big(tree, &res) == VBC_OK)
+    {
+        small = want.n > 1 ? (uint64_t)want.d[1] << 32 : 0;
+        small |= want.n ? want.d[0] : 0;
+        if (res.d)
+            ok = res.n == want.n && !memcmp(res.d, want.d, 4 * want.n);
+        else
+            ok = want.n <= 2 && res.small == small;
+        ok = ok && eval_tree(tree) == (int)(want.n ? want.d[0] : 0);
+        num_free(&res);
+    }
+    check(ok, "big", what);
+    free(want.d);
+    arena_release(&a);
+}
+
+static void     big_format(const char *s, const char *want)
+{
+    arena       a;
+    vbc_error   err;
+    node        *tree;
+    vbc_num     res;
+    char        *out;
+
+    arena_init(&a);
+    out = NULL;
+    if (vbc_parse(s, &a, &tree, &err) == VBC_OK
+        && eval_big(tree, &res) == VBC_OK)
+    {
+        out = num_format(&res);
+        num_free(&res);
+    }
+    check(out && strcmp(out, want) == 0, "big", want);
+    free(out);
+    arena_release(&a);
+}
+
+// Writes "(9*9*...*9+8)" with the most nines that fit in limbs 32-bit limbs:
+// 32 * limbs / log2(9) of them.
+static char     *big_operand(char *s, size_t limbs)
+{
+    size_t  p;
+
+    p = limbs * 32 * 1000000 / 3169926;
+    *s++ = '(';
+    while (--p)
+    {
+        *s++ = '9';
+        *s++ = '*';
+    }
+    memcpy(s, "9+8)", 4);
+    return (s + 4);
+}
+
+// Random sums and products of groups, nested depth deep.
+static char     *big_random(char *s, uint64_t *seed, int depth)
+{
+    int     n;
+    char    op;
+
+    *seed = *seed * 6364136223846793005u + 1442695040888963407u;
+    n = 1 + (*seed >> 33) % 6;
+    op = (*seed >> 40) % 3 ? '*' : '+';
+    while (n--)
+    {
+        *seed = *seed * 6364136223846793005u + 1442695040888963407u;
+        if (depth && (*seed >> 35) % 3)
+        {
+            *s++ = '(';
+            s = big_random(s, seed, depth - 1);
+            *s++ = ')';
+        }
+        else
+            *s++ = '0' + (*seed >> 50) % 10;
+        if (n)
+            *s++ = op;
+    }
+    return (s);
+}
+
+// Operand sizes around KARATSUBA_MIN (32 limbs), odd splits, and a long
+// operand against one at most half its length, which goes in slices.
+static void     test_big(void)
+{
+    static const size_t sizes[][2] = {{31, 31}, {32, 31}, {32, 32}, {33, 32},
+        {33, 33}, {63, 32}, {64, 32}, {65, 32}, {97, 32}, {100, 33},
+        {64, 64}, {129, 64}, {300, 299}, {301, 150}, {999, 3}};
+    uint64_t            seed;
+    char                what[32];
+    char                *s;
+    char                *e;
+    size_t              i;
+
+    s = malloc(1 << 20);
+    if (!s)
+        return ;
+    i = 0;
+    while (i < sizeof(sizes) / sizeof(*sizes))
+    {
+        e = big_operand(s, sizes[i][0]);
+        *e++ = '*';
+        *big_operand(e, sizes[i][1]) = '\0';
+        snprintf(what, sizeof(what), "%zu by %zu limbs", sizes[i][0],
+            sizes[i][1]);
+        big_case(s, what);
+        i++;
+    }
+    seed = 42;
+    i = 0;
+    while (i++ < 300)
+    {
+        *big_random(s, &seed, 5) = '\0';
+        big_case(s, s);
+    }
+    free(s);
+    big_format("9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9",
+        "109418989131512359209");
+    big_format("(9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9"
+        "*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9+8)",
+        "147808829414345923316083210206383297609");
+    big_format("0*(9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9*9+1)", "0");
+}
+// The rules vbc_scan_input follows, one byte at a time: the reference for
+// its vectorized loops.
+static void ref_scan(const char *s, int flags, vbc_scan *sc)
+{
+    size_t  depth;
+    size_t  i;
+    int     prev;
+    int     num;
+    int     c;
+
+    memset(sc, 0, sizeof(*sc));
+    sc->bad = (size_t)-1;
+    sc->close = (size_t)-1;
+    depth = 0;
+    prev = 0;
+    i = 0;
+    while (s[i] && sc->close == (size_t)-1)
+    {
+        c = s[i];
+        num = (flags & VBC_NUMBERS) && c >= '0' && c <= '9';
+        if (c >= 'a' && c <= 'z' && (flags & VBC_VARS))
+            c = '0';
+        sc->multi |= num && prev == 2;
+        if (sc->bad == (size_t)-1 && !(num && prev == 2)
+            && ((c >= '0' && c <= '9') || c == '(' ? prev != 0
+                : c == ')' || c == '+' || c == '*' ? prev == 0 : 1))
+            sc->bad = i;
+        prev = c >= '0' && c <= '9' ? 1 + num : c == ')';
+        if (c == '(' && ++depth > sc->depth)
+            sc->depth = depth;
+        if (c == ')' && depth-- == 0)
+            sc->close = i;
+        i++;
+    }
+    sc->len = i + strlen(s + i);
+    if (sc->close != (size_t)-1)
+        sc->bad = sc->close;
+    if (sc->bad == (size_t)-1 && (depth || !prev))
+        sc->bad = sc->len;
+    sc->valid = sc->bad == (size_t)-1;
+    if (sc->valid)
+        sc->bad = sc->len;
+    if (sc->close == (size_t)-1)
+        sc->close = sc->len;
+}
+
+// Compares every field with ref_scan at every alignment the loops see.
+static void scan_case(char *buf, const char *s, const char *what)
+{
+    vbc_scan    sc;
+    vbc_scan    want;
+    size_t      len;
+    size_t      off;
+    int         flags;
+    int         ok;
+
+    len = strlen(s);
+    ok = 1;
+    flags = 0;
+    while (flags < 8)
+    {
+        ref_scan(s, flags, &want);
+        off = 0;
+        while (off < 32)
+        {
+            memcpy(buf + off, s, len + 1);
+            vbc_scan_input(buf + off, flags, &sc);
+            ok &= sc.len == want.len && sc.depth == want.depth
+                && sc.bad == want.bad && sc.close == want.close
+                && sc.valid == want.valid && sc.multi == want.multi;
+            off++;
+        }
+        flags += 2;
+    }
+    check(ok, "scan", what);
+}
+
+// Random expressions with up to two bytes replaced, and deep nesting with a
+// ')' that closes nothing in a later block than the first error.
+static void test_scan(void)
+{
+    static const char   alphabet[] = "0123456789+*()az? ";
+    char                *buf;
+    char                *s;
+    char                *end;
+    uint64_t            seed;
+    int                 i;
+    int                 k;
+
+    buf = malloc(2 << 16);
+    if (!buf)
+        return ;
+    s = buf + (1 << 16);
+    seed = 11;
+    i = 0;
+    while (i++ < 300)
+    {
+        end = big_random(s, &seed, i % 5);
+        *end = '\0';
+        k = i % 3;
+        while (k-- && end > s)
+        {
+            seed = seed * 6364136223846793005u + 1442695040888963407u;
+            s[(seed >> 33) % (end - s)] = alphabet[(seed >> 20) % 18];
+        }
+        scan_case(buf, s, "random");
+    }
+    k = 0;
+    while (k < 300)
+    {
+        s[k] = '(';
+        s[600 - k++] = ')';
+    }
+    s[300] = '7';
+    s[301] = '+';
+    s[302] = '\0';
+    scan_case(buf, s, "300 deep, unclosed");
+    s[301] = ')';
+    s[601] = '\0';
+    scan_case(buf, s, "300 deep");
+    s[601] = ')';
+    s[602] = '\0';
+    scan_case(buf, s, "300 deep, one ')' too many");
+    s[100] = '+';
+    scan_case(buf, s, "300 deep, an error, then one ')' too many");
+    free(buf);
+}
+
+// Under VBC_NUMBERS: the value of a literal, wrapped in 64 bits and then
+// kept modulo 2^32.
+static int  number(const char *s, size_t len)
+{
+    uint64_t    v;
+
+    v = 0;
+    while (len--)
+        v = v * 10 + (uint64_t)(*s++ - '0');
+    return ((int)(unsigned int)v);
+}
+
+static void number_case(const char *s, int want)
+{
+    arena       a;
+    vbc_error   err;
+    int         res;
+
+    arena_init(&a);
+    res = ~want;
+    vbc_eval(s, VBC_TREE, VBC_NUMBERS, &a, &res, &err);
+    check(err.code == VBC_OK && res == want, "numbers", s);
+    arena_release(&a);
+}
+
+// read_number loads eight bytes at a time while they are inside the input:
+// every length from 1 to 20 digits, inside an expression, and ending right
+// before a NUL that is the last byte of a page followed by a guard page.
+static void test_numbers(void)
+{
+    static const char   digits[] = "98765432109876543210";
+    char                buf[64];
+    char                *page;
+    char                *s;
+    long                size;
+    size_t              k;
+
+    size = sysconf(_SC_PAGESIZE);
+    page = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED || mprotect(page + size, size, PROT_NONE))
+        return ;
+    k = 1;
+    while (k <= 20)
+    {
+        snprintf(buf, sizeof(buf), "(%.*s)*3+7", (int)k, digits);
+        number_case(buf, (int)((unsigned int)number(digits, k) * 3 + 7));
+        snprintf(buf, sizeof(buf), "2*%.*s", (int)k, digits + 20 - k);
+        number_case(buf, (int)(2u * number(digits + 20 - k, k)));
+        s = page + size - k - 3;
+        memcpy(s, "1+", 2);
+        memcpy(s + 2, digits, k);
+        s[k + 2] = '\0';
+        number_case(s, (int)(1u + number(digits, k)));
+        k++;
+    }
+    number_case("4294967296", 0);
+    number_case("4294967297*5", 5);
+    number_case("18446744073709551615", -1);
+    number_case("18446744073709551616", 0);
+    number_case("99999999999999999999", number("99999999999999999999", 20));
+    number_case("007+08", 15);
+    munmap(page, 2 * size);
+}
+
+static void test_columns(void)
+{
+    enum { ROWS = 1003 };
+    static int  a[ROWS];
+    static int  b[ROWS];
+    static int  out[ROWS];
+    const int   *cols[VBC_NVARS];
+    program     empty;
+    vbc_error   err;
+    int         ok;
+    int         i;
+
+    memset(cols, 0, sizeof(cols));
+    cols[0] = a;
+    cols[1] = b;
+    i = 0;
+    while (i < ROWS)
+    {
+        a[i] = i * 7919 - 3;
+        b[i] = ROWS - i;
+        i++;
+    }
+    ok = vbc_eval_columns("a*b+3*a+(b+1)*(a+2)", cols, ROWS, out, &err)
+        == VBC_OK;
+    i = 0;
+    while (ok && i < ROWS)
+    {
+        ok = out[i] == (int)((unsigned int)a[i] * b[i] + 3u * a[i]
+                + (b[i] + 1u) * (a[i] + 2u));
+        i++;
+    }
+    check(ok, "columns", "a*b+3*a+(b+1)*(a+2)");
+    check(vbc_eval_columns("a+c", cols, ROWS, out, &err) == VBC_EUNEXPECTED
+        && err.pos == 2, "columns", "unbound column c");
+    empty.code = NULL;
+    empty.len = 0;
+    empty.depth = 0;
+    out[0] = 1;
+    check(run_columns(&empty, cols, ROWS, out) && out[0] == 0
+        && out[ROWS - 1] == 0, "columns", "empty program");
+}
+
+// Applies the edit to text as well and compares the tree with a fresh parse.
+static void edit(vbc_incr *t, char *text, size_t off, size_t del,
+                const char *ins)
+{
+    arena       a;
+    vbc_error   err;
+    vbc_error   fresh;
+    int         res;
+
+    memmove(text + off + strlen(ins), text + off + del,
+        strlen(text + off + del) + 1);
+    memcpy(text + off, ins, strlen(ins));
+    incr_edit(t, off, del, ins, &err);
+    arena_init(&a);
+    res = 0;
+    vbc_eval(text, VBC_BYTECODE, 0, &a, &res, &fresh);
+    arena_release(&a);
+    check(err.code == fresh.code
+        && (err.code != VBC_OK || incr_value(t) == res), "incremental", text);
+}
+
+static void test_incremental(void)
+{
+    vbc_incr    t;
+    vbc_error   err;
+    char        *text;
+    size_t      n;
+    size_t      i;
+
+    n = 20000;
+    text = malloc(2 * n + 64);
+    if (!text)
+        return ;
+    strcpy(text, "1+2*3");
+    check(incr_init(&t, text, &err) == VBC_OK && incr_value(&t) == 7,
+        "incremental", text);
+    edit(&t, text, 2, 1, "(4+5)");
+    edit(&t, text, 6, 1, "");
+    edit(&t, text, 6, 0, ")");
+    edit(&t, text, 0, 1, "9*9");
+    incr_free(&t);
+    i = 0;
+    while (i < n)
+    {
+        text[2 * i] = '0' + i % 10;
+        text[2 * i + 1] = i % 3 ? '*' : '+';
+        i++;
+    }
+    text[2 * n - 1] = '\0';
+    check(incr_init(&t, text, &err) == VBC_OK, "incremental", "long chain");
+    edit(&t, text, n, 1, "7");
+    edit(&t, text, n + 1, 1, "*");
+    edit(&t, text, 0, 0, "(");
+    edit(&t, text, 2 * n, 0, ")*3");
+    incr_free(&t);
+    free(text);
+}
+
+// Runs run_batch on the len bytes of in from a file in a child, and compares
+// its output and exit status with what single mode prints for each line.
+static void batch_case(const char *in, size_t len, const char *what)
+{
+    arena       a;
+    vbc_error   err;
+    char        path[2][64];
+    char        *want;
+    char        *out;
+    char        *line;
+    const char  *end;
+    size_t      n;
+    size_t      i;
+    pid_t       pid;
+    int         failed;
+    int         status;
+    int         fd;
+    int         res;
+
+    snprintf(path[0], 64, "/tmp/test_vbc.%d.in", (int)getpid());
+    snprintf(path[1], 64, "/tmp/test_vbc.%d.out", (int)getpid());
+    want = malloc((len / 2 + 1) * 32 + 1);
+    out = malloc((len / 2 + 1) * 32 + 1);
+    line = malloc(len + 1);
+    fd = open(path[0], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (!want || !out || !line || fd < 0
+        || write(fd, in, len) != (ssize_t)len)
+    {
+        check(0, "batch", what);
+        if (fd >= 0)
+            close(fd);
+        free(want);
+        free(out);
+        free(line);
+        return ;
+    }
+    close(fd);
+    arena_init(&a);
+    failed = 0;
+    n = 0;
+    i = 0;
+    while (i < len)
+    {
+        end = memchr(in + i, '\n', len - i);
+        end = end ? end : in + len;
+        memcpy(line, in + i, end - (in + i));
+        line[end - (in + i)] = '\0';
+        i = end - in + 1;
+        vbc_eval(line, VBC_DIRECT, 0, &a, &res, &err);
+        if (err.code == VBC_OK)
+            n += sprintf(want + n, "%d", res);
+        else
+            n += vbc_strerror(&err, want + n, 32);
+        want[n++] = '\n';
+        failed |= err.code != VBC_OK;
+    }
+    arena_release(&a);
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0)
+    {
+        fd = open(path[1], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0 || dup2(fd, 1) < 0)
+            _exit(2);
+        status = run_batch(path[0], VBC_BYTECODE, 0);
+        fflush(stdout);
+        _exit(status);
+    }
+    status = -1;
+    if (pid > 0)
+        waitpid(pid, &status, 0);
+    fd = open(path[1], O_RDONLY);
+    i = 0;
+    while (fd >= 0 && (res = read(fd, out + i, n + 1 - i)) > 0)
+        i += res;
+    if (fd >= 0)
+        close(fd);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == failed && i == n
+        && memcmp(out, want, n) == 0, "batch", what);
+    unlink(path[0]);
+    unlink(path[1]);
+    free(want);
+    free(out);
+    free(line);
+}
+
+// Lines across several chunks, with errors, deep lines and no final newline,
+// then a file of exactly one page whose last line has no newline, which is
+// read instead of mapped.
+static void test_batch(void)
+{
+    static const char   *lines[] = {"2*(3+4)", "1++", "x", "(1+2", "9",
+        "1+2)", "(((8)))*7+6"};
+    char                *in;
+    char                *deep;
+    size_t              len;
+    size_t              page;
+    size_t              i;
+    int                 want;
+
+    deep = deep_line(100000, &want);
+    in = malloc(((size_t)3 << 20) + 5 * 600002);
+    if (!deep || !in)
+    {
+        free(deep);
+        free(in);
+        return ;
+    }
+    len = 0;
+    i = 0;
+    while (len < (size_t)3 << 20)
+    {
+        if (i % 100000 == 50000)
+            len += sprintf(in + len, "%s\n", deep);
+        len += sprintf(in + len, "%s\n", lines[i % 7]);
+        len += sprintf(in + len, "%d*%d+%d\n", (int)(i % 10),
+            (int)(i / 10 % 10), (int)(i / 100 % 10));
+        i++;
+    }
+    len += sprintf(in + len, "%s", deep);
+    batch_case(in, len, "lines across chunks");
+    page = sysconf(_SC_PAGESIZE);
+    len = 0;
+    while (len < page - 8)
+        len += sprintf(in + len, "1+2\n");
+    len += sprintf(in + len, "1+\n(2)*3");
+    batch_case(in, len, "a page without a final newline");
+    free(deep);
+    free(in);
+}
+
+// Runs a server on path in a child with stderr discarded; it stops at
+// SIGTERM.
+static pid_t    start_server(const char *path)
+{
+    pid_t   pid;
+    int     fd;
+
+    pid = fork();
+    if (pid != 0)
+        return (pid);
+    fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0)
+        dup2(fd, 2);
+    _exit(run_server(path, VBC_BYTECODE, 0));
+}
+
+// Connects to path, waiting up to two seconds for the server to listen.
+static int      connect_server(const char *path)
+{
+    struct sockaddr_un  addr;
+    int                 fd;
+    int                 i;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    i = 0;
+    while (i++ < 200)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return (-1);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+            return (fd);
+        close(fd);
+        usleep(10000);
+    }
+    return (-1);
+}
+
+// Sends len bytes of req and reads answers into out until the server closes
+// the connection. Returns how many bytes were read.
+static size_t   ask(const char *path, const char *req, size_t len, char *out,
+                    size_t cap)
+{
+    ssize_t r;
+    size_t  n;
+    int     fd;
+
+    fd = connect_server(path);
+    if (fd < 0)
+        return (0);
+    n = 0;
+    while (n < len && (r = write(fd, req + n, len - n)) > 0)
+        n += r;
+    shutdown(fd, SHUT_WR);
+    n = 0;
+    while (n < cap && (r = read(fd, out + n, cap - n)) > 0)
+        n += r;
+    close(fd);
+    return (n);
+}
+
+static void     test_server(void)
+{
+    static const char   answers[] = "14\nUnexpected token ')'\n9\n";
+    struct sockaddr_un  addr;
+    char                path[64];
+    char                out[64];
+    char                *big;
+    size_t              n;
+    pid_t               pid;
+    int                 status;
+    int                 fd;
+
+    signal(SIGPIPE, SIG_IGN);
+    snprintf(path, sizeof(path), "/tmp/test_vbc.%d.sock", (int)getpid());
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || write(fd, "keep", 4) != 4)
+        return ;
+    close(fd);
+    pid = start_server(path);
+    status = -1;
+    waitpid(pid, &status, 0);
+    fd = open(path, O_RDONLY);
+    n = fd < 0 ? 0 : (size_t)read(fd, out, sizeof(out));
+    if (fd >= 0)
+        close(fd);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 1 && n == 4
+        && memcmp(out, "keep", 4) == 0, "server", "regular file at path");
+    unlink(path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return ;
+    close(fd);
+    pid = start_server(path);
+    n = ask(path, "2*(3+4)\n1++)\n9", 15, out, sizeof(out));
+    check(n == sizeof(answers) - 1 && memcmp(out, answers, n) == 0, "server",
+        "pipelined requests over a stale socket");
+    n = (size_t)80 << 20;
+    big = malloc(n);
+    if (big)
+    {
+        memset(big, '1', n);
+        n = ask(path, big, n, out, sizeof(out));
+        check(n == 14 && memcmp(out, "Line too long\n", 14) == 0, "server",
+            "line without a newline");
+    }
+    free(big);
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0
+        && access(path, F_OK) == -1, "server", "stops at SIGTERM");
+}
+
+int main(void)
+{
+    test_modes();
+    test_arena();
+    test_dag();
+    test_pool();
+    test_bytecode();
+    test_deep();
+    test_simplify();
+    test_stream();
+    test_errors();
+    test_parallel();
+    test_reentrant();
+    test_big();
+    test_scan();
+    test_numbers();
+    test_columns();
+    test_incremental();
+    test_batch();
+    test_server();
+    printf("test_vbc: %d checks, %d failed\n", g_checks, g_failed);
+    return (g_failed != 0);
+}
@@ -0,0 +1,402 @@
+#ifndef VBC_H
+# define VBC_H
+
+// libvbc: parse and evaluate vbc expressions without printing or exiting.
+// Every function is reentrant; all state lives in the structures passed in,
+// except for the worker threads of eval_parallel, which the process shares.
+// Build the CLI with: cc -O2 -pthread vbc0.c vbc_*.c -o vbc
+// and the tests with: cc -pthread test_vbc.c vbc_*.c -o test_vbc
+
+# include <stddef.h>
+# include <stdint.h>
+
+// A VAR leaf is variable 'a' + val; only VBC_VARS parsing makes one.
+typedef struct node {
+    enum {
+        ADD,
+        MULTI,
+        VAL,
+        VAR
+    }   type;
+    int val;
+    struct node *l;
+    struct node *r;
+}   node;
+
+// Errors carry the byte offset of the offending character. VBC_EEND is an
+// unexpected end of input, whose offset is the length of the expression.
+// VBC_EIO is a failed read in vbc_eval_fd.
+typedef enum vbc_status {
+    VBC_OK,
+    VBC_EUNEXPECTED,
+    VBC_EEND,
+    VBC_ENOMEM,
+    VBC_EIO
+}   vbc_status;
+
+typedef struct vbc_error {
+    vbc_status  code;
+    size_t      pos;
+    char        token;
+}   vbc_error;
+
+// Formats err the way the subject prints it, without the trailing newline.
+// A token that does not print, such as a NUL read by vbc_eval_fd, is shown
+// as a C escape: Unexpected token '\0'.
+int         vbc_strerror(const vbc_error *err, char *buf, size_t size);
+
+// vbc_arena.c
+// Nodes are bump-allocated from a chain of blocks owned by one arena per
+// parse. Each block is twice the size of the previous one, so a tree of n
+// nodes costs O(log n) mallocs and is released in one sweep over the blocks.
+typedef struct arena_block {
+    struct arena_block  *next;
+    size_t              used;
+    size_t              cap;
+    node                nodes[];
+}   arena_block;
+
+typedef struct arena {
+    arena_block *head;
+    arena_block *tail;
+    size_t      nodes;  // nodes handed out
+    size_t      blocks; // malloc calls made
+    size_t      bytes;  // bytes requested from malloc
+}   arena;
+
+// A position in the arena. Rewinding to a mark gives back every node
+// allocated since, which is how dead subtrees are pruned during parsing.
+typedef struct arena_mark {
+    arena_block *b;
+    size_t      used;
+    size_t      nodes;
+}   arena_mark;
+
+void        arena_init(arena *a);
+void        arena_reset(arena *a);
+void        arena_release(arena *a);
+node        *new_node(arena *a, node n);
+arena_mark  arena_get_mark(const arena *a);
+void        arena_rewind(arena *a, arena_mark m);
+
+// vbc_dag.c
+// Hash-consing: every node is looked up by (type, val, l, r) before it is
+// allocated, so structurally identical subtrees are built once and shared.
+// Children are interned first, which makes pointer equality of children the
+// same as structural equality.
+typedef struct hashcons {
+    node    **slots;
+    size_t  cap;        // power of two
+    size_t  unique;     // nodes in the table
+    size_t  requests;   // nodes asked for by the parser
+}   hashcons;
+
+int         hashcons_init(hashcons *h);
+void        hashcons_reset(hashcons *h);
+void        hashcons_free(hashcons *h);
+node        *hashcons_node(hashcons *h, arena *a, node n);
+
+// Evaluates a DAG whose nodes are the only ones in a, each exactly once, by
+// walking the arena in allocation order (children always come before their
+// parents). Results are stored in the val field of ADD and MULTI nodes.
+int         eval_dag(const arena *a, const node *root);
+vbc_status  vbc_eval_dag(const char *s, int flags, arena *a, hashcons *h,
+                int *res, vbc_error *err);
+
+// vbc_scan.c
+// Validates an expression in one vectorized pass (SSE2 or AVX2 on x86-64,
+// bytes elsewhere): the alphabet, the order of tokens and the parentheses.
+// flags are vbc_build flags; VBC_VARS also accepts variables as operands,
+// VBC_NUMBERS runs of digits. When valid is 0, bad is where the parser
+// reports its error (len for the end of input). close is the first ')' that
+// closes nothing, len if none. Every parser reports such a ')' before any
+// other error, wherever it is, as the subject's check_balance does.
+typedef struct vbc_scan {
+    size_t  len;
+    size_t  depth;  // deepest parenthesis nesting
+    size_t  bad;
+    size_t  close;
+    int     valid;
+    int     multi;  // some number has more than one digit
+}   vbc_scan;
+
+void        vbc_scan_input(const char *s, int flags, vbc_scan *sc);
+
+// vbc_parse.c
+// How a parser makes nodes: from the arena, or through a hash-consing table,
+// optionally simplifying each ADD and MULTI as it is built. VBC_VARS accepts
+// the letters 'a' to 'z' as single-letter variables. VBC_NUMBERS reads a run
+// of digits as one decimal number, computed in 64 bits and kept modulo 2^32
+// in val like every result; by default each digit is an operand of its own,
+// as the subject requires.
+# define VBC_SIMPLIFY 1
+# define VBC_VARS 2
+# define VBC_NUMBERS 4
+
+typedef struct vbc_build {
+    arena       *a;
+    hashcons    *dag;
+    int         flags;
+}   vbc_build;
+
+node        *vbc_make(const vbc_build *b, node n);
+
+// Both parsers build the same left-leaning tree. vbc_parse uses heap stacks
+// and handles any nesting depth; vbc_parse_recursive is the original
+// recursive descent, kept as a reference.
+vbc_status  vbc_parse(const char *s, arena *a, node **root, vbc_error *err);
+vbc_status  vbc_parse_ex(const char *s, const vbc_build *b, node **root,
+                vbc_error *err);
+vbc_status  vbc_parse_recursive(const char *s, arena *a, node **root,
+                vbc_error *err);
+
+// vbc_simplify.c
+// Builds n = l op r with constants folded, x*0 to 0, x*1 and x+0 to x. ml and
+// mr mark where the operands' subtrees start in the arena; whatever a rule
+// makes unreachable at the top of the arena is given back.
+node        *simplify(const vbc_build *b, node n, arena_mark ml, arena_mark mr);
+
+// vbc_eval.c
+// Variables are not bound here and read as 0; eval_bound reads variable
+// 'a' + v from vars[v], and run_columns binds whole columns.
+int         eval_tree(const node *tree);
+int         eval_bound(const node *tree, const int *vars);
+
+// Tree-less evaluation: one pass over the input keeping a running sum and
+// product per parenthesis level. Feed characters to direct_step, NUL last.
+typedef struct frame {
+    unsigned int    sum;
+    unsigned int    prod;
+}   frame;
+
+typedef struct direct {
+    frame   *f;
+    size_t  depth;
+    size_t  cap;
+    int     operand;
+}   direct;
+
+int         direct_init(direct *d);
+int         direct_step(direct *d, char c);
+void        direct_free(direct *d);
+vbc_status  vbc_eval_direct(const char *s, int *res, vbc_error *err);
+
+// The same over a file descriptor read VBC_STREAM_CHUNK bytes at a time, so
+// input of any length is evaluated in memory proportional to its nesting.
+// One newline at the very end is ignored; error offsets count from the first
+// byte read. As a ')' that closes nothing takes priority, the input is read
+// to the end after any other error.
+# define VBC_STREAM_CHUNK (1 << 16)
+
+vbc_status  vbc_eval_fd(int fd, int *res, vbc_error *err);
+
+// Bytecode: the tree lowered to a contiguous postfix program. A compiled
+// program does not reference the tree or the input, so it can be run any
+// number of times after the arena is released.
+typedef enum opcode {
+    OP_PUSH,
+    OP_ADD,
+    OP_MUL,
+    OP_VAR
+}   opcode;
+
+typedef struct insn {
+    opcode  op;
+    int     arg;
+}   insn;
+
+typedef struct program {
+    insn    *code;
+    size_t  len;
+    size_t  depth;  // value stack slots needed by run_program
+}   program;
+
+// run_bound reads variable 'a' + v from vars[v]; run_program reads 0.
+int         compile_tree(const node *tree, program *p);
+int         run_program(const program *p, int *res);
+int         run_bound(const program *p, const int *vars, int *res);
+void        free_program(program *p);
+
+// vbc_columns.c
+// Runs a program over n rows at once: variable 'a' + v reads cols[v][row]
+// and out[row] receives the row's result. Rows are taken in blocks and each
+// instruction is applied to a whole block with vector instructions, so a
+// formula is interpreted once per block rather than once per row. Columns of
+// unused variables may be NULL. Returns 0 if memory ran out or a used
+// column is missing.
+# define VBC_NVARS 26
+
+int         run_columns(const program *p, const int *const *cols, size_t n,
+                int *out);
+vbc_status  vbc_eval_columns(const char *s, const int *const *cols, size_t n,
+                int *out, vbc_error *err);
+
+// vbc_pool.c
+// Structure-of-arrays trees: node i is type[i] (ADD, MULTI or VAL) with
+// children l[i] and r[i], 32-bit indices into the same arrays; a VAL keeps
+// its digit in l. 9 bytes per node and no per-node allocation. depth is the
+// value stack pool_eval needs, which returns 0 if memory ran out.
+# define POOL_MAX UINT32_MAX
+
+typedef struct node_pool {
+    unsigned char   *type;
+    uint32_t        *l;
+    uint32_t        *r;
+    uint32_t        n;
+    uint32_t        cap;
+    uint32_t        root;
+    size_t          depth;
+}   node_pool;
+
+void        pool_init(node_pool *p);
+vbc_status  pool_parse(const char *s, node_pool *p, vbc_error *err);
+int         pool_eval(const node_pool *p, int *res);
+void        pool_destroy(node_pool *p);
+
+// vbc_nary.c
+// Flattened trees: a run of operands joined by '+' or by '*' is one ADD or
+// MULTI node of n operands, nodes first to first + n - 1, which sit next to
+// each other. A sum of 100k terms is one node rather than a chain 100k deep.
+// Nodes are in structure-of-arrays form and each one follows its operands,
+// so nary_eval is one forward pass with no recursion and no stack, reducing
+// every node's operands in a contiguous loop. It stores each node's value in
+// val and returns the root's, which is the last node.
+typedef struct nary_tree {
+    unsigned char   *type;  // ADD, MULTI or VAL
+    uint32_t        *first;
+    uint32_t        *n;
+    unsigned int    *val;   // a VAL's digit
+    size_t          len;
+    size_t          cap;
+}   nary_tree;
+
+void        nary_init(nary_tree *t);
+vbc_status  nary_parse(const char *s, nary_tree *t, vbc_error *err);
+int         nary_eval(nary_tree *t);
+void        nary_destroy(nary_tree *t);
+
+// vbc_jit.c
+// Native code for a tree on x86-64: fn(vars) returns what eval_bound would.
+// jit_compile returns 1, or 0 and leaves fn NULL where that is not possible
+// (other architectures, no executable mappings, or a value stack deeper than
+// JIT_MAX_DEPTH); jit_call then runs the bytecode kept in prog with
+// run_bound, so the tree may be released either way. -1 if memory ran out.
+// jit_call stores the result in res and returns 0 if memory ran out.
+# define JIT_MAX_DEPTH (1 << 16)
+
+typedef int (*vbc_jit_fn)(const int *vars);
+
+typedef struct vbc_jit {
+    vbc_jit_fn  fn;
+    void        *code;
+    size_t      size;
+    program     prog;
+}   vbc_jit;
+
+int         jit_compile(const node *tree, vbc_jit *j);
+int         jit_call(const vbc_jit *j, const int *vars, int *res);
+void        jit_free(vbc_jit *j);
+
+// vbc_big.c
+// Exact evaluation, for results that overflow int. A value is small while
+// it fits in 64 bits and d, n little-endian 32-bit limbs after that. eval_big
+// walks any depth with an explicit stack and multiplies chains of factors
+// as balanced product trees, with Karatsuba for long operands. The low 32
+// bits of the result are what eval_tree returns. Variables read as 0.
+typedef struct vbc_num {
+    uint64_t    small;
+    uint32_t    *d;
+    size_t      n;
+    size_t      cap;
+}   vbc_num;
+
+vbc_status  eval_big(const node *tree, vbc_num *res);
+char        *num_format(const vbc_num *x);
+void        num_free(vbc_num *x);
+
+// vbc_par.c
+// Evaluates tree on nthreads threads, the caller being one of them, with the
+// same result as eval_tree at any depth. A tree of at most cutoff nodes is
+// evaluated on the spot, and one thread runs the tree's bytecode; otherwise
+// each thread splits off work-stealing tasks for idle threads at most once
+// every cutoff nodes. The threads are started by the first call that needs
+// them, at most nthreads - 1 of them for the whole process, and sleep
+// between calls; a call made while another one has them runs as a single
+// thread. Returns 0 if memory ran out.
+# define VBC_PAR_CUTOFF 4096
+
+int         eval_parallel(const node *tree, int nthreads, size_t cutoff,
+                int *res);
+
+// vbc_incr.c
+// A tree that is kept between edits of one expression. Every node caches its
+// value and the length of its source, parentheses included, so an edit
+// reparses only the smallest enclosing subtree that still parses on its own
+// and recomputes the path to the root: O(edit + depth) for chains of any
+// length, which are built balanced.
+# define INCR_GROUP (VAR + 1)
+# define INCR_SLAB 1024    // nodes per malloc
+
+typedef struct inode {
+    int             type;   // ADD, MULTI, VAL or INCR_GROUP (child in l)
+    unsigned int    val;
+    size_t          len;
+    struct inode    *parent;
+    struct inode    *l;
+    struct inode    *r;
+}   inode;
+
+// While the expression does not parse, root is NULL and text holds it.
+typedef struct vbc_incr {
+    inode               *root;
+    inode               *free;
+    struct incr_slab    *slabs;
+    size_t              nodes;      // live nodes
+    size_t              blocks;     // malloc calls made for nodes
+    size_t              len;        // length of the expression
+    size_t              reparsed;   // bytes parsed by the last edit
+    char                *text;
+}   vbc_incr;
+
+// incr_edit replaces del bytes at off with ins. Both return the status of
+// the whole expression after the change; incr_value is its value when OK.
+vbc_status  incr_init(vbc_incr *t, const char *s, vbc_error *err);
+vbc_status  incr_edit(vbc_incr *t, size_t off, size_t del, const char *ins,
+                vbc_error *err);
+int         incr_value(const vbc_incr *t);
+void        incr_free(vbc_incr *t);
+
+// Evaluation strategies shared by vbc_eval and the CLI.
+typedef enum vbc_mode {
+    VBC_TREE,
+    VBC_RECURSIVE,
+    VBC_DIRECT,
+    VBC_BYTECODE,
+    VBC_DAG,
+    VBC_PARALLEL,
+    VBC_POOL,
+    VBC_JIT,
+    VBC_NARY
+}   vbc_mode;
+
+// Parses and evaluates s in one call. flags are vbc_build flags for the modes
+// that build a tree. a is scratch space for those modes and is reset, not
+// released, so a caller looping over requests can keep it.
+vbc_status  vbc_eval(const char *s, vbc_mode mode, int flags, arena *a,
+                int *res, vbc_error *err);
+
+// vbc_batch.c
+// Evaluates every line of the file at path ("-" for stdin) on all cores and
+// writes what single mode would print for each to stdout, in input order.
+// Returns the exit status: 1 if a line failed, the file could not be read or
+// memory ran out, in which case nothing is written.
+int         run_batch(const char *path, vbc_mode mode, int flags);
+
+// vbc_server.c
+// Answers one expression per line on stdin/stdout when path is "-",
+// otherwise on a Unix socket bound at path, until end of input or SIGINT or
+// SIGTERM. Installs handlers for both and ignores SIGPIPE. Returns the exit
+// status: 1 if the socket could not be set up or stdout failed.
+int         run_server(const char *path, vbc_mode mode, int flags);
+
+#endif
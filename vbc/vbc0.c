@@ -1,208 +1,184 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "vbc.h"
 
-typedef struct node {
-    enum {
-        ADD,
-        MULTI,
-        VAL
-    }   type;
-    int val;
-    struct node *l;
-    struct node *r;
-}   node;
-
-
-
-node    *new_node(node n)
-{
-    node *ret = calloc(1, sizeof(n));
-    if (!ret)
-        return (NULL);
-    *ret = n;
-    return (ret);
-}
-
-void    destroy_tree(node *n)
-{
-    if (!n)
-        return ;
-    if (n->type != VAL)
-    {
-        destroy_tree(n->l);
-        destroy_tree(n->r);
-    }
-    free(n);
-}
-
-
-
-
-void    unexpected(char c)
+static int  run_stream(const char *path)
 {
-    if (c)
-        printf("Unexpected token '%c'\n", c);
-    else
-        printf("Unexpected end of input\n"); //+++++++++++++++
-}
+    vbc_error   err;
+    char        msg[32];
+    int         fd;
+    int         res;
 
-int accept(char **s, char c)
-{
-    if (**s == c)   //+++++++++++++++
-    {
-        (*s)++;
+    fd = path[0] == '-' && !path[1] ? 0 : open(path, O_RDONLY);
+    if (fd < 0)
         return (1);
-    }
-    return (0);
-}
-
-int expect(char **s, char c)
-{
-    if (accept(s, c))
-        return (1);
-    unexpected(**s);
-    return (0);
-}
-
-//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-
-int      check_balance(char *s);
-node    *parse_number_or_group(char **s);
-node    *parse_addition(char **s);
-node    *parse_multiplication(char **s);
-
-
-node    *parse_number_or_group(char **s)
-{
-    node    *res;
-    node    tmp;
-
-    res = NULL;
-    if (**s == '(')
-    {
-        (*s)++;
-        res = parse_addition(s);
-        if (!res || **s != ')')
-        {
-            destroy_tree(res);
-            unexpected(**s);
-            return (NULL);
-        }
-        (*s)++;
-        return (res);
-    }
-    if (isdigit(**s))
+    vbc_eval_fd(fd, &res, &err);
+    if (fd)
+        close(fd);
+    if (err.code == VBC_OK)
+        printf("%d\n", res);
+    else if (err.code == VBC_EUNEXPECTED || err.code == VBC_EEND)
     {
-        tmp.type = VAL;
-        tmp.val = **s - '0';
-        res = new_node(tmp);
-        (*s)++;
-        return (res);
+        vbc_strerror(&err, msg, sizeof(msg));
+        printf("%s at byte %zu\n", msg, err.pos);
     }
-    unexpected(**s);
-    return (NULL);
+    return (err.code != VBC_OK);
 }
 
-node    *parse_addition(char **s)
+// Never simplified: folding constants would wrap them.
+static int  run_big(const char *s)
 {
-    node    *left;
-    node    *right;
-    node    tmp;
-
-    left = parse_multiplication(s);
-    if (!left)
-        return (NULL);
-    while (**s == '+')
+    arena       a;
+    vbc_build   b;
+    vbc_error   err;
+    vbc_num     res;
+    node        *tree;
+    char        *out;
+    char        msg[32];
+
+    arena_init(&a);
+    b.a = &a;
+    b.dag = NULL;
+    b.flags = 0;
+    out = NULL;
+    if (vbc_parse_ex(s, &b, &tree, &err) == VBC_OK
+        && (err.code = eval_big(tree, &res)) == VBC_OK)
     {
-        (*s)++;
-        right = parse_multiplication(s);
-        if (!right)
-        {
-            destroy_tree(left);
-            return (NULL);
-        }
-        tmp.type = ADD;
-        tmp.l = left;
-        tmp.r = right;
-        left = new_node(tmp);
+        out = num_format(&res);
+        num_free(&res);
+        err.code = out ? VBC_OK : VBC_ENOMEM;
     }
-    return (left);
+    arena_release(&a);
+    if (out)
+        printf("%s\n", out);
+    else if (err.code != VBC_ENOMEM && vbc_strerror(&err, msg, sizeof(msg)))
+        printf("%s\n", msg);
+    free(out);
+    return (err.code != VBC_OK);
 }
 
-
-node    *parse_multiplication(char **s)
+static void print_stats(const arena *a, const hashcons *h)
 {
-    node    *left;
-    node    *right;
-    node    tmp;
-
-    left = parse_number_or_group(s);
-    if (!left)
-        return (NULL);
-    while (**s == '*')
-    {
-        (*s)++;
-        right = parse_number_or_group(s);
-        if (!right)
-        {
-            destroy_tree(left);
-            return (NULL);
-        }
-        tmp.type = MULTI;
-        tmp.l = left;
-        tmp.r = right;
-        left = new_node(tmp);
-    }
-    return (left);
+    fprintf(stderr, "nodes: %zu, mallocs: %zu, bytes: %zu\n",
+        a->nodes, a->blocks, a->bytes);
+    if (!h)
+        return ;
+    fprintf(stderr, "dag: %zu of %zu nodes unique, dedup %.2fx, "
+        "node bytes saved: %zu, table bytes: %zu\n", h->unique, h->requests,
+        h->unique ? (double)h->requests / h->unique : 0.0,
+        (h->requests - h->unique) * sizeof(node), h->cap * sizeof(node *));
 }
 
-
-int check_balance(char *s)
+// Usage: vbc [-S] [-O] [-N] [MODE] EXPR, vbc -B EXPR,
+// vbc [-O] [-N] [MODE] -b FILE, vbc [-O] [-N] [MODE] -s PATH or vbc -f FILE.
+// MODE is -r for the recursive parser, -d to evaluate while parsing without
+// building a tree, -c to run the tree as compiled bytecode, -D to share
+// identical subtrees and evaluate each once, -P to evaluate big trees on all
+// cores, -p to build the tree as a compact index-based pool, -j to compile it
+// to native code or -n to build it with one node per run of '+' or '*'. -O
+// simplifies the tree while it is built. -N reads a run of digits as one
+// number, wrapped to int like the results, except under -r, -d, -p and -n,
+// which keep to single digits. -S prints arena statistics to stderr, plus the
+// sharing achieved under -D. -b evaluates every line of FILE ("-" for stdin)
+// across all cores and exits with 1 if any line failed. -s answers
+// newline-framed requests on stdin/stdout ("-") or on a Unix socket at PATH
+// until end of input or SIGINT/SIGTERM, then reports latency percentiles. -f
+// streams one expression of any size from FILE ("-" for stdin) and reports
+// errors with their byte offset. -B prints the exact value in decimal, however
+// large, instead of wrapping to int. With a single argument the argument is
+// always the expression, as the subject requires.
+int main(int argc, char **argv)
 {
-    int balance;
-    int i;
-
-    balance = 0;
-    i = 0;
-    while (s[i])
+    arena       a;
+    hashcons    h;
+    vbc_error   err;
+    vbc_mode    mode;
+    char        msg[32];
+    int         stats;
+    int         flags;
+    int         batch;
+    int         server;
+    int         stream;
+    int         big;
+    int         res;
+    int         i;
+
+    stats = 0;
+    flags = 0;
+    batch = 0;
+    server = 0;
+    stream = 0;
+    big = 0;
+    mode = VBC_TREE;
+    i = 1;
+    while (i < argc - 1 && argv[i][0] == '-' && argv[i][1] && !argv[i][2])
     {
-        if (s[i] == '(')
-            balance++;
-        else if (s[i] == ')')
-        {
-            balance--;
-            if (balance < 0)
-                return (-1);
-        }
+        if (argv[i][1] == 'S')
+            stats = 1;
+        else if (argv[i][1] == 'O')
+            flags |= VBC_SIMPLIFY;
+        else if (argv[i][1] == 'N')
+            flags |= VBC_NUMBERS;
+        else if (argv[i][1] == 'b')
+            batch = 1;
+        else if (argv[i][1] == 's')
+            server = 1;
+        else if (argv[i][1] == 'f')
+            stream = 1;
+        else if (argv[i][1] == 'B')
+            big = 1;
+        else if (argv[i][1] == 'r')
+            mode = VBC_RECURSIVE;
+        else if (argv[i][1] == 'd')
+            mode = VBC_DIRECT;
+        else if (argv[i][1] == 'c')
+            mode = VBC_BYTECODE;
+        else if (argv[i][1] == 'D')
+            mode = VBC_DAG;
+        else if (argv[i][1] == 'P')
+            mode = VBC_PARALLEL;
+        else if (argv[i][1] == 'p')
+            mode = VBC_POOL;
+        else if (argv[i][1] == 'j')
+            mode = VBC_JIT;
+        else if (argv[i][1] == 'n')
+            mode = VBC_NARY;
+        else
+            return (1);
         i++;
     }
-    return (balance);
-}
-
-int eval_tree(node *tree)
-{
-    switch (tree->type)
-    {
-        case ADD:
-            return (eval_tree(tree->l) + eval_tree(tree->r));
-        case MULTI:
-            return (eval_tree(tree->l) * eval_tree(tree->r));
-        case VAL:
-            return (tree->val);
-    }
-    return (0);
-}
-
-int main(int argc, char **argv)
-{
-    if (argc != 2)
+    if (i != argc - 1)
         return (1);
-    if (check_balance(argv[1]) == -1)
-        return(printf("Unexpected token ')'"), 1);
-    node *tree = parse_addition(&argv[1]);
-    if (!tree)
+    // Lines read by batch and server mode can nest far deeper than eval_tree
+    // can recurse, on a worker's stack least of all, so their default tree
+    // is run as bytecode, with the same result at any depth.
+    if ((batch || server) && mode == VBC_TREE)
+        mode = VBC_BYTECODE;
+    if (batch)
+        return (run_batch(argv[i], mode, flags));
+    if (server)
+        return (run_server(argv[i], mode, flags));
+    if (stream)
+        return (run_stream(argv[i]));
+    if (big)
+        return (run_big(argv[i]));
+    arena_init(&a);
+    if (mode == VBC_DAG && !hashcons_init(&h))
         return (1);
-    printf("%d\n", eval_tree(tree));
-    destroy_tree(tree);
+    if (mode == VBC_DAG)
+        vbc_eval_dag(argv[i], flags, &a, &h, &res, &err);
+    else
+        vbc_eval(argv[i], mode, flags, &a, &res, &err);
+    if (err.code == VBC_OK)
+        printf("%d\n", res);
+    else if (err.code != VBC_ENOMEM && vbc_strerror(&err, msg, sizeof(msg)))
+        printf("%s\n", msg);
+    if (err.code == VBC_OK && stats)
+        print_stats(&a, mode == VBC_DAG ? &h : NULL);
+    if (mode == VBC_DAG)
+        hashcons_free(&h);
+    arena_release(&a);
+    return (err.code != VBC_OK);
 }
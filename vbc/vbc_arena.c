@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include "vbc.h"
+
+#define ARENA_MIN_NODES 64
+
+void    arena_init(arena *a)
+{
+    a->head = NULL;
+    a->tail = NULL;
+    a->nodes = 0;
+    a->blocks = 0;
+    a->bytes = 0;
+}
+
+static arena_block *arena_grow(arena *a)
+{
+    arena_block *b;
+    size_t      cap;
+
+    cap = a->tail ? a->tail->cap * 2 : ARENA_MIN_NODES;
+    b = malloc(sizeof(*b) + cap * sizeof(node));
+    if (!b)
+        return (NULL);
+    b->next = NULL;
+    b->used = 0;
+    b->cap = cap;
+    if (a->tail)
+        a->tail->next = b;
+    else
+        a->head = b;
+    a->tail = b;
+    a->blocks++;
+    a->bytes += sizeof(*b) + cap * sizeof(node);
+    return (b);
+}
+
+void    arena_release(arena *a)
+{
+    arena_block *b;
+    arena_block *next;
+
+    b = a->head;
+    while (b)
+    {
+        next = b->next;
+        free(b);
+        b = next;
+    }
+    arena_init(a);
+}
+
+// Forgets every node but keeps the blocks, so a caller evaluating many
+// expressions stops calling malloc once its arena is warm.
+void    arena_reset(arena *a)
+{
+    a->tail = a->head;
+    if (a->head)
+        a->head->used = 0;
+    a->nodes = 0;
+}
+
+node    *new_node(arena *a, node n)
+{
+    arena_block *b;
+    node        *ret;
+
+    b = a->tail;
+    if (b && b->used == b->cap && b->next)
+    {
+        b = b->next;
+        b->used = 0;
+        a->tail = b;
+    }
+    if (!b || b->used == b->cap)
+    {
+        b = arena_grow(a);
+        if (!b)
+            return (NULL);
+    }
+    ret = &b->nodes[b->used++];
+    *ret = n;
+    a->nodes++;
+    return (ret);
+}
+
+arena_mark  arena_get_mark(const arena *a)
+{
+    arena_mark  m;
+
+    m.b = a->tail;
+    m.used = a->tail ? a->tail->used : 0;
+    m.nodes = a->nodes;
+    return (m);
+}
+
+void    arena_rewind(arena *a, arena_mark m)
+{
+    if (!m.b)
+    {
+        arena_reset(a);
+        return ;
+    }
+    a->tail = m.b;
+    a->tail->used = m.used;
+    a->nodes = m.nodes;
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vbc.h"
+
+// Batch mode: newline-separated expressions are cut into chunks of about
+// BATCH_CHUNK bytes on line boundaries. Worker threads claim chunks from an
+// atomic counter and format their results into a per-chunk buffer, which the
+// main thread writes out in chunk order, so output follows input order.
+#define BATCH_CHUNK (1 << 20)
+
+typedef struct chunk {
+    char    *begin;
+    char    *end;
+    char    *out;
+    size_t  len;
+    size_t  cap;
+    int     failed;
+}   chunk;
+
+typedef struct batch {
+    chunk           *chunks;
+    size_t          n;
+    atomic_size_t   next;
+    vbc_mode        mode;
+    int             flags;
+    atomic_int      oom;
+}   batch;
+
+static int  chunk_print(chunk *c, int res, const vbc_error *err)
+{
+    char    *out;
+    int     n;
+
+    if (c->cap - c->len < 32)
+    {
+        out = realloc(c->out, c->cap ? c->cap * 2 : 4096);
+        if (!out)
+            return (0);
+        c->out = out;
+        c->cap = c->cap ? c->cap * 2 : 4096;
+    }
+    if (err->code == VBC_OK)
+        n = snprintf(c->out + c->len, 32, "%d", res);
+    else
+        n = vbc_strerror(err, c->out + c->len, 32);
+    c->len += n;
+    c->out[c->len++] = '\n';
+    c->failed |= err->code != VBC_OK;
+    return (1);
+}
+
+static void *batch_worker(void *arg)
+{
+    batch       *b;
+    chunk       *c;
+    arena       a;
+    vbc_error   err;
+    char        *line;
+    char        *nl;
+    size_t      i;
+    int         res;
+
+    b = arg;
+    arena_init(&a);
+    while ((i = atomic_fetch_add(&b->next, 1)) < b->n && !atomic_load(&b->oom))
+    {
+        c = &b->chunks[i];
+        line = c->begin;
+        while (line < c->end)
+        {
+            nl = memchr(line, '\n', c->end - line);
+            *nl = '\0';
+            vbc_eval(line, b->mode, b->flags, &a, &res, &err);
+            if (err.code == VBC_ENOMEM || !chunk_print(c, res, &err))
+            {
+                atomic_store(&b->oom, 1);
+                break ;
+            }
+            line = nl + 1;
+        }
+    }
+    arena_release(&a);
+    return (NULL);
+}
+
+// Maps the file (or slurps stdin for "-") privately and writable, so each
+// newline can be overwritten with a NUL in place. One spare byte is kept
+// after the data for a final line that has no newline; when that byte would
+// fall on a page past the end of the file, the file is read instead.
+static char *batch_load(const char *path, size_t *len, size_t *maplen)
+{
+    struct stat st;
+    char        *buf;
+    char        *tmp;
+    size_t      cap;
+    ssize_t     r;
+    int         fd;
+
+    fd = path[0] == '-' && !path[1] ? 0 : open(path, O_RDONLY);
+    if (fd < 0)
+        return (NULL);
+    *maplen = 0;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        *len = st.st_size;
+        *maplen = *len + 1;
+        buf = mmap(NULL, *maplen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (buf != MAP_FAILED && (buf[*len - 1] == '\n'
+            || *len % sysconf(_SC_PAGESIZE)))
+            return (fd ? close(fd) : 0, buf);
+        if (buf != MAP_FAILED)
+            munmap(buf, *maplen);
+        *maplen = 0;
+    }
+    cap = BATCH_CHUNK;
+    buf = malloc(cap);
+    *len = 0;
+    r = 0;
+    while (buf && (r = read(fd, buf + *len, cap - *len - 1)) > 0)
+    {
+        *len += r;
+        if (cap - *len > 1)
+            continue ;
+        tmp = realloc(buf, cap * 2);
+        if (!tmp)
+            free(buf);
+        buf = tmp;
+        cap *= 2;
+    }
+    if (fd)
+        close(fd);
+    if (buf && r < 0)
+        return (free(buf), NULL);
+    return (buf);
+}
+
+int     run_batch(const char *path, vbc_mode mode, int flags)
+{
+    batch       b;
+    pthread_t   *th;
+    char        *buf;
+    char        *p;
+    size_t      len;
+    size_t      maplen;
+    long        nth;
+    long        t;
+    size_t      i;
+    int         ret;
+
+    buf = batch_load(path, &len, &maplen);
+    if (!buf)
+        return (1);
+    if (len && buf[len - 1] != '\n')
+        buf[len++] = '\n';
+    b.n = len / BATCH_CHUNK + 1;
+    b.chunks = calloc(b.n, sizeof(*b.chunks));
+    nth = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nth < 1)
+        nth = 1;
+    th = malloc(nth * sizeof(*th));
+    ret = 1;
+    if (b.chunks && th)
+    {
+        p = buf;
+        i = 0;
+        while (i < b.n)
+        {
+            b.chunks[i].begin = p;
+            if (i + 1 < b.n && p < buf + (i + 1) * BATCH_CHUNK)
+                p = memchr(buf + (i + 1) * BATCH_CHUNK - 1, '\n',
+                    len - ((i + 1) * BATCH_CHUNK - 1)) + 1;
+            else if (i + 1 == b.n)
+                p = buf + len;
+            b.chunks[i++].end = p;
+        }
+        atomic_init(&b.next, 0);
+        atomic_init(&b.oom, 0);
+        b.mode = mode;
+        b.flags = flags;
+        t = 0;
+        while (t < nth && pthread_create(&th[t], NULL, batch_worker, &b) == 0)
+            t++;
+        if (t == 0)
+            batch_worker(&b);
+        while (t > 0)
+            pthread_join(th[--t], NULL);
+        ret = atomic_load(&b.oom);
+        i = 0;
+        while (i < b.n)
+        {
+            if (!atomic_load(&b.oom))
+                fwrite(b.chunks[i].out, 1, b.chunks[i].len, stdout);
+            ret |= b.chunks[i].failed;
+            free(b.chunks[i++].out);
+        }
+    }
+    free(b.chunks);
+    free(th);
+    if (maplen)
+        munmap(buf, maplen);
+    else
+        free(buf);
+    return (ret);
+}
@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vbc.h"
+
+// Exact evaluation. Values are natural numbers, so no sign is kept: a value
+// lives in small until checked 64-bit arithmetic overflows, then in d as
+// little-endian 32-bit limbs. Products of big values use Karatsuba above
+// KARATSUBA_MIN limbs and schoolbook below.
+//
+// The tree is walked with an explicit stack and every maximal run of one
+// operator is flattened first, parentheses or not, so a run's operands are
+// evaluated and then combined in one go. Sums are accumulated in place;
+// products are multiplied pairwise as a balanced tree, so a chain of n
+// factors costs O(M(N) log n) for an N-limb result instead of the O(N^2) of
+// multiplying into an accumulator one factor at a time.
+#define KARATSUBA_MIN 32
+
+typedef uint32_t    limb;
+
+static void     limbs_add(limb *d, size_t dn, const limb *s, size_t sn)
+{
+    uint64_t    c;
+    size_t      i;
+
+    c = 0;
+    i = 0;
+    while (i < sn)
+    {
+        c += (uint64_t)d[i] + s[i];
+        d[i++] = (limb)c;
+        c >>= 32;
+    }
+    while (c && i < dn)
+    {
+        c += d[i];
+        d[i++] = (limb)c;
+        c >>= 32;
+    }
+}
+
+// d -= s, where d >= s.
+static void     limbs_sub(limb *d, size_t dn, const limb *s, size_t sn)
+{
+    uint64_t    t;
+    uint64_t    b;
+    size_t      i;
+
+    b = 0;
+    i = 0;
+    while (i < sn || (b && i < dn))
+    {
+        t = (uint64_t)d[i] - (i < sn ? s[i] : 0) - b;
+        d[i++] = (limb)t;
+        b = (t >> 32) & 1;
+    }
+}
+
+static size_t   limbs_trim(const limb *d, size_t n)
+{
+    while (n && !d[n - 1])
+        n--;
+    return (n);
+}
+
+static void     mul_school(const limb *a, size_t na, const limb *b, size_t nb,
+                    limb *out)
+{
+    uint64_t    c;
+    size_t      i;
+    size_t      j;
+
+    i = 0;
+    while (i < na)
+    {
+        c = 0;
+        j = 0;
+        while (j < nb)
+        {
+            c += (uint64_t)a[i] * b[j] + out[i + j];
+            out[i + j++] = (limb)c;
+            c >>= 32;
+        }
+        out[i++ + nb] = (limb)c;
+    }
+}
+
+static int      mul_limbs(const limb *a, size_t na, const limb *b, size_t nb,
+                    limb *out);
+
+// a is at least twice as long as b: multiply it in slices of b's length.
+static int      mul_slices(const limb *a, size_t na, const limb *b, size_t nb,
+                    limb *out)
+{
+    limb    *tmp;
+    size_t  off;
+    size_t  k;
+
+    tmp = malloc(2 * nb * sizeof(*tmp));
+    if (!tmp)
+        return (0);
+    off = 0;
+    while (off < na)
+    {
+        k = na - off < nb ? na - off : nb;
+        memset(tmp, 0, (k + nb) * sizeof(*tmp));
+        if (!mul_limbs(a + off, k, b, nb, tmp))
+            return (free(tmp), 0);
+        limbs_add(out + off, na + nb - off, tmp, k + nb);
+        off += k;
+    }
+    free(tmp);
+    return (1);
+}
+
+// a0 * b0 and a1 * b1 go straight into the low and high halves of out, and
+// (a0 + a1)(b0 + b1) - a0b0 - a1b1 is added in at limb m.
+static int      mul_karatsuba(const limb *a, size_t na, const limb *b,
+                    size_t nb, limb *out)
+{
+    limb    *sa;
+    limb    *sb;
+    limb    *z;
+    size_t  m;
+    size_t  n;
+
+    m = na / 2;
+    n = na - m + 1;
+    sa = calloc(4 * n, sizeof(*sa));
+    if (!sa)
+        return (0);
+    sb = sa + n;
+    z = sb + n;
+    memcpy(sa, a + m, (na - m) * sizeof(*sa));
+    limbs_add(sa, n, a, m);
+    memcpy(sb, b + m, (nb - m) * sizeof(*sb));
+    limbs_add(sb, n, b, m);
+    if (!mul_limbs(a, m, b, m, out)
+        || !mul_limbs(a + m, na - m, b + m, nb - m, out + 2 * m)
+        || !mul_limbs(sa, limbs_trim(sa, n), sb, limbs_trim(sb, n), z))
+        return (free(sa), 0);
+    limbs_sub(z, 2 * n, out, 2 * m);
+    limbs_sub(z, 2 * n, out + 2 * m, na + nb - 2 * m);
+    limbs_add(out + m, na + nb - m, z, limbs_trim(z, 2 * n));
+    free(sa);
+    return (1);
+}
+
+// out, na + nb limbs, must be zeroed. Returns 0 if memory ran out.
+static int      mul_limbs(const limb *a, size_t na, const limb *b, size_t nb,
+                    limb *out)
+{
+    if (na < nb)
+        return (mul_limbs(b, nb, a, na, out));
+    if (!nb)
+        return (1);
+    if (nb < KARATSUBA_MIN)
+        return (mul_school(a, na, b, nb, out), 1);
+    if (2 * nb <= na)
+        return (mul_slices(a, na, b, nb, out));
+    return (mul_karatsuba(a, na, b, nb, out));
+}
+
+// The limbs of x, through buf for a small value.
+static const limb   *num_limbs(const vbc_num *x, limb *buf, size_t *n)
+{
+    if (x->d)
+        return (*n = x->n, x->d);
+    buf[0] = (limb)x->small;
+    buf[1] = (limb)(x->small >> 32);
+    *n = limbs_trim(buf, 2);
+    return (buf);
+}
+
+void    num_free(vbc_num *x)
+{
+    free(x->d);
+    x->d = NULL;
+    x->n = 0;
+    x->cap = 0;
+    x->small = 0;
+}
+
+static int      num_is_zero(const vbc_num *x)
+{
+    return (x->d ? x->n == 0 : x->small == 0);
+}
+
+// Gives x room for cap limbs, converting a small value.
+static int      num_reserve(vbc_num *x, size_t cap)
+{
+    limb    *d;
+
+    if (x->d && cap <= x->cap)
+        return (1);
+    d = realloc(x->d, cap * sizeof(*d));
+    if (!d)
+        return (0);
+    if (!x->d)
+    {
+        d[0] = (limb)x->small;
+        d[1] = (limb)(x->small >> 32);
+        x->n = limbs_trim(d, 2);
+    }
+    x->d = d;
+    x->cap = cap;
+    return (1);
+}
+
+// acc += x, in place once acc is big.
+static int      num_add(vbc_num *acc, const vbc_num *x)
+{
+    limb        buf[2];
+    const limb  *xs;
+    uint64_t    sum;
+    size_t      xn;
+    size_t      n;
+
+    if (!acc->d && !x->d && !__builtin_add_overflow(acc->small, x->small,
+            &sum))
+        return (acc->small = sum, 1);
+    xs = num_limbs(x, buf, &xn);
+    n = (acc->d ? acc->n : 2) > xn ? (acc->d ? acc->n : 2) : xn;
+    if (!num_reserve(acc, 2 * (n + 1)))
+        return (0);
+    memset(acc->d + acc->n, 0, (n + 1 - acc->n) * sizeof(*acc->d));
+    limbs_add(acc->d, n + 1, xs, xn);
+    acc->n = limbs_trim(acc->d, n + 1);
+    return (1);
+}
+
+// r = a * b; a and b are released.
+static int      num_mul(vbc_num *a, vbc_num *b, vbc_num *r)
+{
+    limb        abuf[2];
+    limb        bbuf[2];
+    const limb  *as;
+    const limb  *bs;
+    size_t      an;
+    size_t      bn;
+    vbc_num     t;
+
+    t.d = NULL;
+    t.n = 0;
+    t.cap = 0;
+    t.small = 0;
+    if ((!a->d && !b->d && !__builtin_mul_overflow(a->small, b->small,
+            &t.small)) || num_is_zero(a) || num_is_zero(b))
+        return (num_free(a), num_free(b), *r = t, 1);
+    as = num_limbs(a, abuf, &an);
+    bs = num_limbs(b, bbuf, &bn);
+    t.d = calloc(an + bn, sizeof(*t.d));
+    if (!t.d || !mul_limbs(as, an, bs, bn, t.d))
+        return (free(t.d), 0);
+    t.cap = an + bn;
+    t.n = limbs_trim(t.d, t.cap);
+    num_free(a);
+    num_free(b);
+    *r = t;
+    return (1);
+}
+
+typedef struct bframe {
+    int     type;
+    size_t  begin;  // operands in ops[begin..end)
+    size_t  next;
+    size_t  end;
+    size_t  vbase;  // their values from vals[vbase]
+}   bframe;
+
+typedef struct beval {
+    const node  **ops;
+    size_t      nops;
+    size_t      opcap;
+    vbc_num     *vals;
+    size_t      nvals;
+    size_t      valcap;
+    bframe      *f;
+    size_t      nf;
+    size_t      fcap;
+    const node  **walk;
+    size_t      walkcap;
+}   beval;
+
+static int      grow(void **p, size_t *cap, size_t need, size_t size)
+{
+    void    *tmp;
+    size_t  n;
+
+    if (need <= *cap)
+        return (1);
+    n = *cap ? *cap : 64;
+    while (n < need)
+        n *= 2;
+    tmp = realloc(*p, n * size);
+    if (!tmp)
+        return (0);
+    *p = tmp;
+    *cap = n;
+    return (1);
+}
+
+static int      push_val(beval *e, unsigned int v)
+{
+    if (!grow((void **)&e->vals, &e->valcap, e->nvals + 1, sizeof(*e->vals)))
+        return (0);
+    memset(&e->vals[e->nvals], 0, sizeof(*e->vals));
+    e->vals[e->nvals++].small = v;
+    return (1);
+}
+
+// Appends the operands of the run of n->type rooted at n, in source order,
+// and opens a frame over them.
+static int      open_run(beval *e, const node *n)
+{
+    const node  *m;
+    size_t      sp;
+
+    if (!grow((void **)&e->f, &e->fcap, e->nf + 1, sizeof(*e->f)))
+        return (0);
+    e->f[e->nf].type = n->type;
+    e->f[e->nf].begin = e->nops;
+    e->f[e->nf].next = e->nops;
+    e->f[e->nf].vbase = e->nvals;
+    e->walk[0] = n;
+    sp = 1;
+    while (sp)
+    {
+        m = e->walk[--sp];
+        if (m->type != n->type)
+        {
+            if (!grow((void **)&e->ops, &e->opcap, e->nops + 1,
+                    sizeof(*e->ops)))
+                return (0);
+            e->ops[e->nops++] = m;
+            continue ;
+        }
+        if (!grow((void **)&e->walk, &e->walkcap, sp + 2, sizeof(*e->walk)))
+            return (0);
+        e->walk[sp++] = m->r;
+        e->walk[sp++] = m->l;
+    }
+    e->f[e->nf++].end = e->nops;
+    return (1);
+}
+
+// Replaces the frame's values with their sum or product.
+static int      close_run(beval *e, const bframe *f)
+{
+    vbc_num t;
+    vbc_num *v;
+    size_t  n;
+    size_t  i;
+    size_t  k;
+
+    v = e->vals + f->vbase;
+    n = e->nvals - f->vbase;
+    i = 1;
+    while (f->type == ADD && i < n)
+        if (!num_add(&v[0], &v[i++]))
+            return (0);
+    while (f->type == MULTI && n > 1)
+    {
+        k = 0;
+        i = 0;
+        while (i + 1 < n)
+        {
+            if (!num_mul(&v[i], &v[i + 1], &v[k++]))
+                return (0);
+            i += 2;
+        }
+        if (i < n)
+        {
+            t = v[i];
+            v[i].d = NULL;
+            v[k++] = t;
+        }
+        n = k;
+    }
+    i = f->type == ADD ? 1 : n;
+    while (f->type == ADD && i < e->nvals - f->vbase)
+        num_free(&v[i++]);
+    e->nvals = f->vbase + 1;
+    e->nops = f->begin;
+    return (1);
+}
+
+static int      eval_loop(beval *e, const node *tree)
+{
+    bframe  *f;
+    bframe  top;
+
+    if (tree->type == VAL || tree->type == VAR)
+        return (push_val(e, tree->type == VAL ? (unsigned int)tree->val : 0));
+    if (!open_run(e, tree))
+        return (0);
+    while (e->nf)
+    {
+        f = &e->f[e->nf - 1];
+        if (f->next == f->end)
+        {
+            top = *f;
+            e->nf--;
+            if (!close_run(e, &top))
+                return (0);
+        }
+        else if (e->ops[f->next]->type >= VAL)
+        {
+            if (!push_val(e, e->ops[f->next]->type == VAL
+                    ? (unsigned int)e->ops[f->next]->val : 0))
+                return (0);
+            f->next++;
+        }
+        else if (!open_run(e, e->ops[f->next++]))
+            return (0);
+    }
+    return (1);
+}
+
+vbc_status  eval_big(const node *tree, vbc_num *res)
+{
+    beval   e;
+    int     ok;
+
+    memset(&e, 0, sizeof(e));
+    memset(res, 0, sizeof(*res));
+    ok = grow((void **)&e.walk, &e.walkcap, 2, sizeof(*e.walk))
+        && eval_loop(&e, tree);
+    if (ok)
+        *res = e.vals[0];
+    while (e.nvals > (size_t)ok)
+        num_free(&e.vals[--e.nvals]);
+    free(e.vals);
+    free(e.ops);
+    free(e.f);
+    free(e.walk);
+    return (ok ? VBC_OK : VBC_ENOMEM);
+}
+
+// Repeated division by 10^9 of a copy: quadratic, but done once per result.
+char    *num_format(const vbc_num *x)
+{
+    limb        *q;
+    uint32_t    *chunks;
+    char        *s;
+    uint64_t    r;
+    size_t      n;
+    size_t      k;
+    size_t      i;
+
+    if (!x->d)
+    {
+        s = malloc(21);
+        if (s)
+            snprintf(s, 21, "%llu", (unsigned long long)x->small);
+        return (s);
+    }
+    n = x->n;
+    q = malloc((n + 1) * sizeof(*q));
+    chunks = malloc((n * 32 / 29 + 2) * sizeof(*chunks));
+    s = malloc(9 * (n * 32 / 29 + 2) + 1);
+    if (!q || !chunks || !s)
+        return (free(q), free(chunks), free(s), NULL);
+    memcpy(q, x->d, n * sizeof(*q));
+    k = 0;
+    while (n || !k)
+    {
+        r = 0;
+        i = n;
+        while (i--)
+        {
+            r = (r << 32) | q[i];
+            q[i] = (limb)(r / 1000000000u);
+            r %= 1000000000u;
+        }
+        chunks[k++] = (uint32_t)r;
+        n = limbs_trim(q, n);
+    }
+    i = sprintf(s, "%u", chunks[--k]);
+    while (k--)
+        i += sprintf(s + i, "%09u", chunks[k]);
+    free(q);
+    free(chunks);
+    return (s);
+}
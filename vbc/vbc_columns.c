@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vbc.h"
+
+// Rows go through the program COL_LANES at a time as GCC vectors of 32-bit
+// lanes, a block of such vectors per instruction. The value stack holds one
+// block per slot and a block is sized so that all slots together take about
+// COL_STACK bytes and stay in cache. A PUSH that feeds an ADD or MUL at once
+// is applied to the top block as a scalar instead of being broadcast. On
+// x86-64 the block loop is also built for AVX2 and picked at load time; the
+// helpers are inlined into each version.
+#define COL_LANES 8
+#define COL_STACK (1 << 16)
+#define COL_MAX_VECS 128
+
+#if defined(__GNUC__) && defined(__x86_64__)
+# define COL_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+# define COL_CLONES
+#endif
+
+typedef unsigned int    colvec
+    __attribute__((vector_size(COL_LANES * sizeof(unsigned int))));
+
+typedef struct colblock {
+    colvec      *st;
+    size_t      nv;     // vectors per slot
+    size_t      row;
+    size_t      rows;
+}   colblock;
+
+__attribute__((always_inline))
+static inline void  col_binary(colvec *a, const colvec *b, size_t m, opcode op)
+{
+    size_t  j;
+
+    j = 0;
+    if (op == OP_ADD)
+        while (j < m)
+        {
+            a[j] += b[j];
+            j++;
+        }
+    else
+        while (j < m)
+        {
+            a[j] *= b[j];
+            j++;
+        }
+}
+
+__attribute__((always_inline))
+static inline void  col_scalar(colvec *a, unsigned int k, size_t m, opcode op)
+{
+    size_t  j;
+
+    j = 0;
+    if (op == OP_ADD)
+        while (j < m)
+            a[j++] += k;
+    else
+        while (j < m)
+            a[j++] *= k;
+}
+
+COL_CLONES
+static void     col_run_block(const program *p, const int *const *cols,
+                    const colblock *b, int *out)
+{
+    const insn  *in;
+    colvec      *top;
+    size_t      m;
+    size_t      i;
+    size_t      j;
+
+    m = (b->rows + COL_LANES - 1) / COL_LANES;
+    top = b->st;
+    i = 0;
+    while (i < p->len)
+    {
+        in = &p->code[i++];
+        if (in->op == OP_PUSH && i < p->len
+            && (p->code[i].op == OP_ADD || p->code[i].op == OP_MUL))
+        {
+            col_scalar(top - b->nv, (unsigned int)in->arg, m, p->code[i++].op);
+            continue ;
+        }
+        j = 0;
+        if (in->op == OP_PUSH)
+            while (j < m)
+                top[j++] = (colvec){0} + (unsigned int)in->arg;
+        else if (in->op == OP_VAR)
+        {
+            top[m - 1] = (colvec){0};
+            memcpy(top, cols[in->arg] + b->row, b->rows * sizeof(int));
+        }
+        else
+            col_binary(top - 2 * b->nv, top - b->nv, m, in->op);
+        top = in->op == OP_PUSH || in->op == OP_VAR ? top + b->nv
+            : top - b->nv;
+    }
+    memcpy(out + b->row, b->st, b->rows * sizeof(int));
+}
+
+int     run_columns(const program *p, const int *const *cols, size_t n,
+            int *out)
+{
+    colblock    b;
+    size_t      i;
+
+    i = 0;
+    while (i < p->len)
+        if (p->code[i++].op == OP_VAR && !cols[p->code[i - 1].arg])
+            return (0);
+    if (!p->len)
+        return (memset(out, 0, n * sizeof(*out)), 1);
+    b.nv = COL_STACK / (p->depth * sizeof(colvec));
+    if (b.nv < 1)
+        b.nv = 1;
+    if (b.nv > COL_MAX_VECS)
+        b.nv = COL_MAX_VECS;
+    b.st = aligned_alloc(sizeof(colvec), p->depth * b.nv * sizeof(colvec));
+    if (!b.st)
+        return (0);
+    b.row = 0;
+    while (b.row < n)
+    {
+        b.rows = n - b.row;
+        if (b.rows > b.nv * COL_LANES)
+            b.rows = b.nv * COL_LANES;
+        col_run_block(p, cols, &b, out);
+        b.row += b.rows;
+    }
+    free(b.st);
+    return (1);
+}
+
+// Parses s with variables, simplified, and runs it over the columns. A
+// variable whose column is NULL is reported as an unexpected token.
+vbc_status  vbc_eval_columns(const char *s, const int *const *cols, size_t n,
+                int *out, vbc_error *err)
+{
+    arena       a;
+    vbc_build   b;
+    node        *tree;
+    program     p;
+    size_t      i;
+
+    arena_init(&a);
+    b.a = &a;
+    b.dag = NULL;
+    b.flags = VBC_VARS | VBC_SIMPLIFY;
+    i = 0;
+    if (vbc_parse_ex(s, &b, &tree, err) == VBC_OK)
+        while (s[i] && (s[i] < 'a' || cols[s[i] - 'a']))
+            i++;
+    if (err->code == VBC_OK && s[i])
+    {
+        err->code = VBC_EUNEXPECTED;
+        err->pos = i;
+        err->token = s[i];
+    }
+    else if (err->code == VBC_OK && !compile_tree(tree, &p))
+        err->code = VBC_ENOMEM;
+    else if (err->code == VBC_OK)
+    {
+        if (!run_columns(&p, cols, n, out))
+            err->code = VBC_ENOMEM;
+        free_program(&p);
+    }
+    arena_release(&a);
+    return (err->code);
+}
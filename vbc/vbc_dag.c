@@ -0,0 +1,154 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "vbc.h"
+
+#define HASHCONS_MIN 1024
+
+int     hashcons_init(hashcons *h)
+{
+    h->cap = HASHCONS_MIN;
+    h->slots = calloc(h->cap, sizeof(*h->slots));
+    h->unique = 0;
+    h->requests = 0;
+    return (h->slots != NULL);
+}
+
+void    hashcons_reset(hashcons *h)
+{
+    size_t  i;
+
+    i = 0;
+    while (i < h->cap)
+        h->slots[i++] = NULL;
+    h->unique = 0;
+    h->requests = 0;
+}
+
+void    hashcons_free(hashcons *h)
+{
+    free(h->slots);
+    h->slots = NULL;
+    h->cap = 0;
+}
+
+// The val field of ADD and MULTI nodes is not part of the key: eval_dag
+// stores results there. Leaves are keyed on their digit or variable.
+static size_t   hash(const node *n)
+{
+    uint64_t    x;
+
+    if (n->type >= VAL)
+        x = ((uint64_t)n->val * 0x9E3779B97F4A7C15u) ^ n->type;
+    else
+        x = ((uint64_t)(uintptr_t)n->l * 0x9E3779B97F4A7C15u)
+            ^ ((uint64_t)(uintptr_t)n->r * 0xC2B2AE3D27D4EB4Fu) ^ n->type;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9u;
+    return ((size_t)(x ^ (x >> 32)));
+}
+
+static int      same(const node *a, const node *b)
+{
+    if (a->type != b->type)
+        return (0);
+    if (a->type >= VAL)
+        return (a->val == b->val);
+    return (a->l == b->l && a->r == b->r);
+}
+
+static int      grow(hashcons *h)
+{
+    node    **old;
+    size_t  cap;
+    size_t  i;
+    size_t  j;
+
+    old = h->slots;
+    cap = h->cap;
+    h->slots = calloc(cap * 2, sizeof(*h->slots));
+    if (!h->slots)
+        return (h->slots = old, 0);
+    h->cap = cap * 2;
+    i = 0;
+    while (i < cap)
+    {
+        if (old[i])
+        {
+            j = hash(old[i]) & (h->cap - 1);
+            while (h->slots[j])
+                j = (j + 1) & (h->cap - 1);
+            h->slots[j] = old[i];
+        }
+        i++;
+    }
+    free(old);
+    return (1);
+}
+
+node    *hashcons_node(hashcons *h, arena *a, node n)
+{
+    size_t  i;
+
+    h->requests++;
+    if (2 * (h->unique + 1) > h->cap && !grow(h))
+        return (NULL);
+    i = hash(&n) & (h->cap - 1);
+    while (h->slots[i])
+    {
+        if (same(h->slots[i], &n))
+            return (h->slots[i]);
+        i = (i + 1) & (h->cap - 1);
+    }
+    h->slots[i] = new_node(a, n);
+    if (h->slots[i])
+        h->unique++;
+    return (h->slots[i]);
+}
+
+// A VAR leaf keeps its variable in val and reads as 0, as in eval_tree.
+static unsigned int dag_val(const node *n)
+{
+    return (n->type == VAR ? 0 : (unsigned int)n->val);
+}
+
+int     eval_dag(const arena *a, const node *root)
+{
+    arena_block *b;
+    node        *n;
+    size_t      i;
+
+    b = a->head;
+    while (b)
+    {
+        i = 0;
+        while (i < b->used)
+        {
+            n = &b->nodes[i++];
+            if (n->type == ADD)
+                n->val = (int)(dag_val(n->l) + dag_val(n->r));
+            else if (n->type == MULTI)
+                n->val = (int)(dag_val(n->l) * dag_val(n->r));
+        }
+        if (b == a->tail)
+            break ;
+        b = b->next;
+    }
+    return ((int)dag_val(root));
+}
+
+// a and h are reset first, so both can be reused across calls.
+vbc_status  vbc_eval_dag(const char *s, int flags, arena *a, hashcons *h,
+                int *res, vbc_error *err)
+{
+    vbc_build   b;
+    node        *root;
+
+    arena_reset(a);
+    hashcons_reset(h);
+    b.a = a;
+    b.dag = h;
+    b.flags = flags;
+    if (vbc_parse_ex(s, &b, &root, err) == VBC_OK)
+        *res = eval_dag(a, root);
+    return (err->code);
+}
@@ -0,0 +1,439 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "vbc.h"
+
+// Sums and products wrap modulo 2^32, computed on unsigned values since
+// signed overflow is undefined; every other evaluator matches this.
+int     eval_tree(const node *tree)
+{
+    switch (tree->type)
+    {
+        case ADD:
+            return ((int)((unsigned int)eval_tree(tree->l)
+                + (unsigned int)eval_tree(tree->r)));
+        case MULTI:
+            return ((int)((unsigned int)eval_tree(tree->l)
+                * (unsigned int)eval_tree(tree->r)));
+        case VAL:
+            return (tree->val);
+        case VAR:
+            return (0);
+    }
+    return (0);
+}
+
+int     eval_bound(const node *tree, const int *vars)
+{
+    switch (tree->type)
+    {
+        case ADD:
+            return ((int)((unsigned int)eval_bound(tree->l, vars)
+                + (unsigned int)eval_bound(tree->r, vars)));
+        case MULTI:
+            return ((int)((unsigned int)eval_bound(tree->l, vars)
+                * (unsigned int)eval_bound(tree->r, vars)));
+        case VAL:
+            return (tree->val);
+        case VAR:
+            return (vars[tree->val]);
+    }
+    return (0);
+}
+
+// No nodes are allocated; the only memory is the frame stack, which grows
+// with nesting depth. Arithmetic is done on unsigned values so that overflow
+// wraps exactly as eval_tree does.
+int     direct_init(direct *d)
+{
+    d->cap = 64;
+    d->f = malloc(d->cap * sizeof(*d->f));
+    if (!d->f)
+        return (0);
+    d->depth = 0;
+    d->f[0].sum = 0;
+    d->f[0].prod = 1;
+    d->operand = 1;
+    return (1);
+}
+
+void    direct_free(direct *d)
+{
+    free(d->f);
+    d->f = NULL;
+}
+
+// Consumes one character, NUL meaning end of input. Returns 1 to continue,
+// 0 on a syntax error at c and -1 on allocation failure. After the NUL has
+// been accepted the result is in f[0].sum.
+int     direct_step(direct *d, char c)
+{
+    frame   *f;
+
+    f = &d->f[d->depth];
+    if (d->operand)
+    {
+        if (isdigit(c))
+        {
+            f->prod *= (unsigned int)(c - '0');
+            d->operand = 0;
+            return (1);
+        }
+        if (c != '(')
+            return (0);
+        if (d->depth + 1 == d->cap)
+        {
+            f = realloc(d->f, d->cap * 2 * sizeof(*d->f));
+            if (!f)
+                return (-1);
+            d->f = f;
+            d->cap *= 2;
+        }
+        f = &d->f[++d->depth];
+        f->sum = 0;
+        f->prod = 1;
+        return (1);
+    }
+    if (c == '*')
+        d->operand = 1;
+    else if (c == '+')
+    {
+        f->sum += f->prod;
+        f->prod = 1;
+        d->operand = 1;
+    }
+    else if (c == ')' && d->depth)
+    {
+        d->depth--;
+        d->f[d->depth].prod *= f->sum + f->prod;
+    }
+    else if (!c && !d->depth)
+        f->sum += f->prod;
+    else
+        return (0);
+    return (1);
+}
+
+vbc_status  vbc_eval_direct(const char *s, int *res, vbc_error *err)
+{
+    const char  *start;
+    vbc_scan    sc;
+    direct      d;
+    int         st;
+
+    err->code = VBC_OK;
+    if (!direct_init(&d))
+        return (err->code = VBC_ENOMEM);
+    start = s;
+    while ((st = direct_step(&d, *s)) == 1 && *s)
+        s++;
+    *res = (int)d.f[0].sum;
+    direct_free(&d);
+    if (st == -1)
+        err->code = VBC_ENOMEM;
+    else if (st == 0)
+    {
+        vbc_scan_input(start, 0, &sc);
+        if (sc.close != sc.len)
+            s = start + sc.close;
+        err->code = *s ? VBC_EUNEXPECTED : VBC_EEND;
+        err->pos = s - start;
+        err->token = *s;
+    }
+    return (err->code);
+}
+
+static void     stream_error(vbc_error *err, vbc_status code, size_t pos,
+                    char token)
+{
+    err->code = code;
+    err->pos = pos;
+    err->token = token;
+}
+
+// After a syntax error, reads on for a ')' that closes nothing, which is
+// reported instead. depth is the nesting at the error, and buf[i] the byte
+// at pos.
+static void     stream_close(int fd, char *buf, ssize_t i, ssize_t n,
+                    size_t depth, size_t pos, vbc_error *err)
+{
+    while (n > 0 || (n < 0 && errno == EINTR))
+    {
+        while (i < n && (buf[i] != ')' || depth))
+        {
+            depth += (buf[i] == '(') - (buf[i] == ')');
+            pos++;
+            i++;
+        }
+        if (i < n)
+        {
+            stream_error(err, VBC_EUNEXPECTED, pos, ')');
+            return ;
+        }
+        n = read(fd, buf, VBC_STREAM_CHUNK);
+        i = 0;
+    }
+}
+
+// A newline is held back until the next byte shows it was not the last one.
+// A NUL byte inside the stream is rejected rather than taken as the end.
+vbc_status  vbc_eval_fd(int fd, int *res, vbc_error *err)
+{
+    char        buf[VBC_STREAM_CHUNK];
+    direct      d;
+    ssize_t     n;
+    ssize_t     i;
+    size_t      pos;
+    int         nl;
+    int         st;
+
+    err->code = VBC_OK;
+    if (!direct_init(&d))
+        return (err->code = VBC_ENOMEM);
+    pos = 0;
+    nl = 0;
+    st = 1;
+    while (st == 1 && (n = read(fd, buf, sizeof(buf))) != 0)
+    {
+        if (n < 0 && errno == EINTR)
+            continue ;
+        if (n < 0)
+            st = -2;
+        i = 0;
+        while (st == 1 && i < n)
+        {
+            if (nl)
+                st = 0;
+            else if (buf[i] == '\n')
+                nl = 1;
+            else
+                st = buf[i] ? direct_step(&d, buf[i]) : 0;
+            if (st == 1 && !nl)
+                pos++;
+            i += st == 1;
+        }
+    }
+    if (st == 1 && !direct_step(&d, '\0'))
+        stream_error(err, VBC_EEND, pos, '\0');
+    else if (st == 0)
+    {
+        stream_error(err, VBC_EUNEXPECTED, pos, nl ? '\n' : buf[i]);
+        stream_close(fd, buf, i, n, d.depth, pos + nl, err);
+    }
+    else if (st < 0)
+        err->code = st == -1 ? VBC_ENOMEM : VBC_EIO;
+    *res = (int)d.f[0].sum;
+    direct_free(&d);
+    return (err->code);
+}
+
+void    free_program(program *p)
+{
+    free(p->code);
+    p->code = NULL;
+    p->len = 0;
+    p->depth = 0;
+}
+
+// Walks the tree root, right, left with an explicit stack, which is postfix
+// order reversed, then flips the program in place and measures its depth.
+int     compile_tree(const node *tree, program *p)
+{
+    const node  **todo;
+    const node  **tmp;
+    size_t      n;
+    size_t      cap;
+    size_t      pcap;
+    insn        *code;
+    insn        t;
+    size_t      sp;
+
+    p->code = NULL;
+    p->len = 0;
+    p->depth = 0;
+    pcap = 0;
+    cap = 64;
+    todo = malloc(cap * sizeof(*todo));
+    if (!todo)
+        return (0);
+    todo[0] = tree;
+    n = 1;
+    while (n)
+    {
+        tree = todo[--n];
+        if (p->len == pcap)
+        {
+            pcap = pcap ? pcap * 2 : 64;
+            code = realloc(p->code, pcap * sizeof(*code));
+            if (!code)
+                return (free(todo), free_program(p), 0);
+            p->code = code;
+        }
+        t.op = tree->type == ADD ? OP_ADD : tree->type == MULTI ? OP_MUL
+            : tree->type == VAL ? OP_PUSH : OP_VAR;
+        t.arg = tree->type >= VAL ? tree->val : 0;
+        p->code[p->len++] = t;
+        if (tree->type >= VAL)
+            continue ;
+        if (n + 2 > cap)
+        {
+            cap *= 2;
+            tmp = realloc(todo, cap * sizeof(*todo));
+            if (!tmp)
+                return (free(todo), free_program(p), 0);
+            todo = tmp;
+        }
+        todo[n++] = tree->l;
+        todo[n++] = tree->r;
+    }
+    free(todo);
+    n = 0;
+    while (n < p->len / 2)
+    {
+        t = p->code[n];
+        p->code[n] = p->code[p->len - 1 - n];
+        p->code[p->len - 1 - n] = t;
+        n++;
+    }
+    sp = 0;
+    n = 0;
+    while (n < p->len)
+    {
+        sp = p->code[n].op == OP_PUSH || p->code[n].op == OP_VAR ? sp + 1
+            : sp - 1;
+        n++;
+        if (sp > p->depth)
+            p->depth = sp;
+    }
+    return (1);
+}
+
+// Every instruction reads the top two slots and writes one result, so the
+// loop body is a handful of selects rather than a switch. Slot 0 is a dummy
+// so that the first PUSH can read below the top without a bounds check. A
+// VAR pushes vars[arg], or 0 without vars, as eval_tree reads it.
+int     run_bound(const program *p, const int *vars, int *res)
+{
+    unsigned int    buf[256];
+    unsigned int    *st;
+    unsigned int    a;
+    unsigned int    b;
+    size_t          sp;
+    size_t          i;
+    int             push;
+
+    st = buf;
+    if (p->depth + 2 > sizeof(buf) / sizeof(*buf))
+    {
+        st = malloc((p->depth + 2) * sizeof(*st));
+        if (!st)
+            return (0);
+    }
+    st[0] = 0;
+    st[1] = 0;
+    sp = 1;
+    i = 0;
+    while (i < p->len)
+    {
+        a = st[sp - 1];
+        b = st[sp];
+        push = p->code[i].op == OP_PUSH || p->code[i].op == OP_VAR;
+        sp = push ? sp + 1 : sp - 1;
+        st[sp] = p->code[i].op == OP_PUSH ? (unsigned int)p->code[i].arg
+            : push ? (vars ? (unsigned int)vars[p->code[i].arg] : 0)
+            : p->code[i].op == OP_ADD ? a + b : a * b;
+        i++;
+    }
+    *res = (int)st[sp];
+    if (st != buf)
+        free(st);
+    return (1);
+}
+
+int     run_program(const program *p, int *res)
+{
+    return (run_bound(p, NULL, res));
+}
+
+static vbc_status   vbc_eval_pool(const char *s, int *res, vbc_error *err)
+{
+    node_pool   p;
+
+    pool_init(&p);
+    if (pool_parse(s, &p, err) == VBC_OK && !pool_eval(&p, res))
+        err->code = VBC_ENOMEM;
+    pool_destroy(&p);
+    return (err->code);
+}
+
+static vbc_status   vbc_eval_nary(const char *s, int *res, vbc_error *err)
+{
+    nary_tree   t;
+
+    nary_init(&t);
+    if (nary_parse(s, &t, err) == VBC_OK)
+        *res = nary_eval(&t);
+    nary_destroy(&t);
+    return (err->code);
+}
+
+vbc_status  vbc_eval(const char *s, vbc_mode mode, int flags, arena *a,
+                int *res, vbc_error *err)
+{
+    vbc_build   b;
+    node        *tree;
+    program     prog;
+    hashcons    h;
+    vbc_jit     j;
+    int         vars[VBC_NVARS];
+    int         ok;
+
+    if (mode == VBC_DIRECT)
+        return (vbc_eval_direct(s, res, err));
+    if (mode == VBC_POOL)
+        return (vbc_eval_pool(s, res, err));
+    if (mode == VBC_NARY)
+        return (vbc_eval_nary(s, res, err));
+    if (mode == VBC_DAG)
+    {
+        if (!hashcons_init(&h))
+            return (err->code = VBC_ENOMEM);
+        vbc_eval_dag(s, flags, a, &h, res, err);
+        hashcons_free(&h);
+        return (err->code);
+    }
+    arena_reset(a);
+    b.a = a;
+    b.dag = NULL;
+    b.flags = flags;
+    if (mode == VBC_RECURSIVE)
+        vbc_parse_recursive(s, a, &tree, err);
+    else
+        vbc_parse_ex(s, &b, &tree, err);
+    if (err->code != VBC_OK)
+        return (err->code);
+    if (mode == VBC_TREE || mode == VBC_RECURSIVE)
+        return (*res = eval_tree(tree), VBC_OK);
+    if (mode == VBC_JIT)
+    {
+        if (jit_compile(tree, &j) == -1)
+            return (err->code = VBC_ENOMEM);
+        memset(vars, 0, sizeof(vars));
+        ok = jit_call(&j, vars, res);
+        jit_free(&j);
+        return (err->code = ok ? VBC_OK : VBC_ENOMEM);
+    }
+    if (mode == VBC_PARALLEL)
+        ok = eval_parallel(tree, (int)sysconf(_SC_NPROCESSORS_ONLN),
+                VBC_PAR_CUTOFF, res);
+    else
+    {
+        ok = compile_tree(tree, &prog) && run_program(&prog, res);
+        free_program(&prog);
+    }
+    if (!ok)
+        err->code = VBC_ENOMEM;
+    return (err->code);
+}
@@ -0,0 +1,482 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vbc.h"
+
+// Incremental evaluation. The tree keeps every parenthesis as an INCR_GROUP
+// node and each node caches its value and the length of its source; offsets
+// follow from lengths (a left child or a group's content starts where its
+// parent does, plus one for the '('; a right child starts after the left
+// child and the operator). Chains of one operator are built balanced, which
+// evaluates the same under wrapping arithmetic and keeps paths logarithmic.
+//
+// An edit is applied to the smallest subtree whose source contains it: that
+// text is rendered from the tree, edited and parsed on its own. The result
+// replaces the subtree if it parses and keeps its meaning in place, which
+// only fails for a sum under a product; otherwise the next enclosing subtree
+// is tried. Lengths and values are then recomputed up to the root. An edit
+// that leaves the whole input invalid keeps it as plain text until a later
+// edit makes it parse again.
+
+struct incr_slab {
+    struct incr_slab    *next;
+    inode               nodes[INCR_SLAB];
+};
+
+static inode    *inode_new(vbc_incr *t)
+{
+    struct incr_slab    *s;
+    inode               *n;
+    size_t              i;
+
+    if (!t->free)
+    {
+        s = malloc(sizeof(*s));
+        if (!s)
+            return (NULL);
+        s->next = t->slabs;
+        t->slabs = s;
+        t->blocks++;
+        i = INCR_SLAB;
+        while (i--)
+        {
+            s->nodes[i].l = t->free;
+            t->free = &s->nodes[i];
+        }
+    }
+    n = t->free;
+    t->free = n->l;
+    t->nodes++;
+    return (n);
+}
+
+// Threads the subtrees still to visit through their parent fields, so no
+// stack is needed at any depth.
+static void     inode_release(vbc_incr *t, inode *n)
+{
+    inode   *todo;
+
+    if (n)
+        n->parent = NULL;
+    todo = n;
+    while (todo)
+    {
+        n = todo;
+        todo = n->parent;
+        if (n->type != VAL && n->l)
+        {
+            n->l->parent = todo;
+            todo = n->l;
+        }
+        if (n->type != VAL && n->type != INCR_GROUP)
+        {
+            n->r->parent = todo;
+            todo = n->r;
+        }
+        n->l = t->free;
+        t->free = n;
+        t->nodes--;
+    }
+}
+
+static void     refresh(inode *n)
+{
+    if (n->type == INCR_GROUP)
+    {
+        n->len = n->l->len + 2;
+        n->val = n->l->val;
+    }
+    else if (n->type != VAL)
+    {
+        n->len = n->l->len + 1 + n->r->len;
+        n->val = n->type == ADD ? n->l->val + n->r->val
+            : n->l->val * n->r->val;
+    }
+}
+
+static inode    *make(vbc_incr *t, int type, inode *l, inode *r)
+{
+    inode   *n;
+
+    n = inode_new(t);
+    if (!n)
+        return (NULL);
+    n->type = type;
+    n->parent = NULL;
+    n->l = l;
+    n->r = r;
+    l->parent = n;
+    if (r)
+        r->parent = n;
+    refresh(n);
+    return (n);
+}
+
+// Reduces it[0..n) to a balanced tree of type in it[0], pairing neighbours
+// so that source order is kept.
+static int      balance(vbc_incr *t, inode **it, size_t n, int type)
+{
+    size_t  i;
+    size_t  k;
+
+    while (n > 1)
+    {
+        k = 0;
+        i = 0;
+        while (i + 1 < n)
+        {
+            it[k] = make(t, type, it[i], it[i + 1]);
+            if (!it[k])
+            {
+                while (i < n)
+                    it[++k] = it[i++];
+                return (0);
+            }
+            k++;
+            i += 2;
+        }
+        if (i < n)
+            it[k++] = it[i];
+        n = k;
+    }
+    return (1);
+}
+
+typedef struct ibuild {
+    inode   **items;    // terms, then factors, of every open level
+    size_t  top;
+    size_t  *levels;    // where each open level's terms and factors start
+    size_t  depth;
+}   ibuild;
+
+// Ends the product in progress, which becomes the level's last term.
+static int      end_product(vbc_incr *t, ibuild *b)
+{
+    size_t  f;
+
+    f = b->levels[2 * b->depth + 1];
+    if (!balance(t, b->items + f, b->top - f, MULTI))
+        return (0);
+    b->top = f + 1;
+    b->levels[2 * b->depth + 1] = b->top;
+    return (1);
+}
+
+static int      end_level(vbc_incr *t, ibuild *b)
+{
+    size_t  s;
+
+    s = b->levels[2 * b->depth];
+    if (!end_product(t, b) || !balance(t, b->items + s, b->top - s, ADD))
+        return (0);
+    b->top = s + 1;
+    return (1);
+}
+
+static int      build_loop(vbc_incr *t, ibuild *b, const char *s)
+{
+    inode   *n;
+
+    while (1)
+    {
+        if (*s >= '0' || *s == ')')
+        {
+            if (*s == ')' && !end_level(t, b))
+                return (0);
+            n = *s == ')' ? make(t, INCR_GROUP, b->items[--b->top], NULL)
+                : inode_new(t);
+            if (!n)
+                return (0);
+            if (*s == ')')
+                b->depth--;
+            else
+            {
+                n->type = VAL;
+                n->val = (unsigned int)(*s - '0');
+                n->len = 1;
+                n->parent = NULL;
+                n->l = NULL;
+                n->r = NULL;
+            }
+            b->items[b->top++] = n;
+        }
+        else if (*s == '(')
+        {
+            b->depth++;
+            b->levels[2 * b->depth] = b->top;
+            b->levels[2 * b->depth + 1] = b->top;
+        }
+        else if (*s == '+' && !end_product(t, b))
+            return (0);
+        else if (!*s)
+            return (end_level(t, b));
+        s++;
+    }
+}
+
+// Parses s into a new subtree; NULL with err set if it is not a valid
+// expression or memory ran out.
+static inode    *build(vbc_incr *t, const char *s, vbc_error *err)
+{
+    vbc_scan    sc;
+    ibuild      b;
+    inode       *root;
+    int         ok;
+
+    vbc_scan_input(s, 0, &sc);
+    err->code = VBC_OK;
+    if (!sc.valid)
+    {
+        err->code = s[sc.bad] ? VBC_EUNEXPECTED : VBC_EEND;
+        err->pos = sc.bad;
+        err->token = s[sc.bad];
+        return (NULL);
+    }
+    b.items = malloc((sc.len / 2 + 2) * sizeof(*b.items));
+    b.levels = malloc(2 * (sc.depth + 1) * sizeof(*b.levels));
+    b.top = 0;
+    b.depth = 0;
+    ok = b.items && b.levels;
+    if (ok)
+    {
+        b.levels[0] = 0;
+        b.levels[1] = 0;
+        ok = build_loop(t, &b, s);
+    }
+    while (!ok && b.items && b.top)
+        inode_release(t, b.items[--b.top]);
+    root = ok ? b.items[0] : NULL;
+    if (!ok)
+        err->code = VBC_ENOMEM;
+    free(b.levels);
+    free(b.items);
+    return (root);
+}
+
+// Writes the source of n, n->len bytes, walking with parent pointers.
+static void     render(const inode *n, char *out)
+{
+    const inode *cur;
+    const inode *prev;
+
+    cur = n;
+    prev = n->parent;
+    while (cur != n->parent)
+    {
+        if (prev == cur->parent)
+        {
+            if (cur->type == VAL)
+                *out++ = (char)('0' + cur->val);
+            if (cur->type == INCR_GROUP)
+                *out++ = '(';
+            prev = cur;
+            cur = cur->type == VAL ? cur->parent : cur->l;
+        }
+        else if (prev == cur->l && cur->type != INCR_GROUP)
+        {
+            *out++ = cur->type == ADD ? '+' : '*';
+            prev = cur;
+            cur = cur->r;
+        }
+        else
+        {
+            if (cur->type == INCR_GROUP)
+                *out++ = ')';
+            prev = cur;
+            cur = cur->parent;
+        }
+    }
+}
+
+static int      splice(char **text, size_t *len, size_t off, size_t del,
+                    const char *ins)
+{
+    char    *s;
+    size_t  n;
+
+    n = strlen(ins);
+    s = realloc(*text, *len + (n > del ? n - del : 0) + 1);
+    if (!s)
+        return (0);
+    memmove(s + off + n, s + off + del, *len - off - del);
+    memcpy(s + off, ins, n);
+    *len = *len - del + n;
+    s[*len] = '\0';
+    *text = s;
+    return (1);
+}
+
+vbc_status  incr_init(vbc_incr *t, const char *s, vbc_error *err)
+{
+    t->root = NULL;
+    t->free = NULL;
+    t->slabs = NULL;
+    t->nodes = 0;
+    t->blocks = 0;
+    t->len = strlen(s);
+    t->reparsed = t->len;
+    t->text = NULL;
+    t->root = build(t, s, err);
+    if (!t->root && err->code != VBC_ENOMEM)
+    {
+        t->text = strdup(s);
+        if (!t->text)
+            err->code = VBC_ENOMEM;
+    }
+    return (err->code);
+}
+
+// Edits in plain-text mode, after an edit left the input invalid.
+static vbc_status   edit_text(vbc_incr *t, size_t off, size_t del,
+                        const char *ins, vbc_error *err)
+{
+    if (!splice(&t->text, &t->len, off, del, ins))
+        return (err->code = VBC_ENOMEM);
+    t->reparsed = t->len;
+    t->root = build(t, t->text, err);
+    if (t->root)
+    {
+        free(t->text);
+        t->text = NULL;
+    }
+    return (err->code);
+}
+
+// The deepest node whose source [*at, *at + len] contains [off, off + del].
+static inode    *locate(inode *n, size_t *at, size_t off, size_t del)
+{
+    size_t  o;
+
+    while (n->type != VAL)
+    {
+        o = *at + (n->type == INCR_GROUP);
+        if (off >= o && off + del <= o + n->l->len)
+            n = n->l;
+        else if (n->type == INCR_GROUP)
+            break ;
+        else if (off >= (o += n->l->len + 1) && off + del <= o + n->r->len)
+            n = n->r;
+        else
+            break ;
+        *at = o;
+    }
+    return (n);
+}
+
+static void     replace(vbc_incr *t, inode *old, inode *n)
+{
+    inode   *p;
+
+    p = old->parent;
+    n->parent = p;
+    if (!p)
+        t->root = n;
+    else if (p->l == old)
+        p->l = n;
+    else
+        p->r = n;
+    inode_release(t, old);
+    while (p)
+    {
+        refresh(p);
+        p = p->parent;
+    }
+}
+
+// Tries to replace s, whose source starts at at, with its edited text.
+// Returns 1 if it did, 0 if an enclosing subtree must be tried instead, -1
+// if memory ran out.
+static int      try_subtree(vbc_incr *t, inode *s, size_t at, size_t off,
+                    size_t del, const char *ins, vbc_error *err)
+{
+    char    *text;
+    size_t  len;
+    inode   *n;
+
+    len = s->len;
+    text = malloc(len + 1);
+    if (!text)
+        return (-1);
+    render(s, text);
+    text[len] = '\0';
+    if (!splice(&text, &len, off - at, del, ins))
+        return (free(text), -1);
+    t->reparsed += len;
+    n = build(t, text, err);
+    if (!n || !s->parent || n->type != ADD || s->parent->type != MULTI)
+    {
+        if (n)
+            replace(t, s, n);
+        else if (!s->parent && err->code != VBC_ENOMEM)
+        {
+            t->text = text;
+            t->root = NULL;
+            t->len = len;
+            inode_release(t, s);
+            return (1);
+        }
+        free(text);
+        if (err->code == VBC_ENOMEM)
+            return (-1);
+        return (n != NULL);
+    }
+    inode_release(t, n);
+    free(text);
+    return (0);
+}
+
+vbc_status  incr_edit(vbc_incr *t, size_t off, size_t del, const char *ins,
+                vbc_error *err)
+{
+    inode   *s;
+    size_t  at;
+    int     st;
+
+    err->code = VBC_OK;
+    if (off > t->len)
+        off = t->len;
+    if (del > t->len - off)
+        del = t->len - off;
+    t->reparsed = 0;
+    if (!t->root)
+        return (edit_text(t, off, del, ins, err));
+    at = 0;
+    s = locate(t->root, &at, off, del);
+    while ((st = try_subtree(t, s, at, off, del, ins, err)) == 0)
+    {
+        if (s->parent->type == INCR_GROUP)
+            at--;
+        else if (s == s->parent->r)
+            at -= s->parent->l->len + 1;
+        s = s->parent;
+    }
+    if (st < 0)
+        return (err->code = VBC_ENOMEM);
+    if (t->root)
+    {
+        t->len = t->root->len;
+        err->code = VBC_OK;
+    }
+    return (err->code);
+}
+
+int         incr_value(const vbc_incr *t)
+{
+    return (t->root ? (int)t->root->val : 0);
+}
+
+void        incr_free(vbc_incr *t)
+{
+    struct incr_slab    *s;
+
+    while (t->slabs)
+    {
+        s = t->slabs;
+        t->slabs = s->next;
+        free(s);
+    }
+    free(t->text);
+    t->root = NULL;
+    t->free = NULL;
+    t->text = NULL;
+    t->nodes = 0;
+}
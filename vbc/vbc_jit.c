@@ -0,0 +1,144 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "vbc.h"
+
+// The tree is compiled to bytecode and each instruction becomes a few bytes
+// of x86-64: the top of the value stack lives in eax, the rest on the native
+// stack, and vars arrives in rdi. A PUSH or VAR that an ADD or MUL consumes
+// at once becomes an immediate or memory operand of that instruction, so
+// left-leaning chains never touch the stack. The code is written into an
+// mmap'd page that is only made executable once it is complete, never both
+// writable and executable.
+#if defined(__x86_64__) && defined(MAP_ANONYMOUS)
+# define JIT_X86 1
+#endif
+
+#ifdef JIT_X86
+
+// Longest encoding of one instruction: push rax; mov eax, imm32.
+# define JIT_INSN_MAX 6
+
+static unsigned char    *emit(unsigned char *c, const char *bytes, size_t n)
+{
+    memcpy(c, bytes, n);
+    return (c + n);
+}
+
+static unsigned char    *emit_imm(unsigned char *c, int imm)
+{
+    memcpy(c, &imm, sizeof(imm));
+    return (c + sizeof(imm));
+}
+
+// Emits a PUSH or VAR whose value is consumed by next, or loaded as the new
+// top when next is not an operator.
+static unsigned char    *emit_operand(unsigned char *c, const insn *in,
+                            opcode next, int spill)
+{
+    if (next == OP_ADD && in->op == OP_PUSH)
+        return (emit_imm(emit(c, "\x05", 1), in->arg));
+    if (next == OP_MUL && in->op == OP_PUSH)
+        return (emit_imm(emit(c, "\x69\xC0", 2), in->arg));
+    if (next == OP_ADD)
+        c = emit(c, "\x03\x47", 2);
+    else if (next == OP_MUL)
+        c = emit(c, "\x0F\xAF\x47", 3);
+    else
+    {
+        if (spill)
+            c = emit(c, "\x50", 1);
+        if (in->op == OP_PUSH)
+            return (emit_imm(emit(c, "\xB8", 1), in->arg));
+        c = emit(c, "\x8B\x47", 2);
+    }
+    *c++ = (unsigned char)(in->arg * sizeof(int));
+    return (c);
+}
+
+static size_t   emit_program(const program *p, unsigned char *c)
+{
+    unsigned char   *start;
+    opcode          next;
+    size_t          i;
+
+    start = c;
+    i = 0;
+    while (i < p->len)
+    {
+        if (p->code[i].op == OP_ADD)
+            c = emit(c, "\x59\x01\xC8", 3);
+        else if (p->code[i].op == OP_MUL)
+            c = emit(c, "\x59\x0F\xAF\xC1", 4);
+        else
+        {
+            next = i + 1 < p->len ? p->code[i + 1].op : OP_PUSH;
+            if (next != OP_ADD && next != OP_MUL)
+                next = OP_PUSH;
+            c = emit_operand(c, &p->code[i], next, i > 0);
+            i += next != OP_PUSH;
+        }
+        i++;
+    }
+    *c++ = 0xC3;
+    return (c - start);
+}
+
+static int  jit_native(const program *p, vbc_jit *j)
+{
+    unsigned char   *code;
+    long            page;
+
+    page = sysconf(_SC_PAGESIZE);
+    if (page <= 0 || p->depth > JIT_MAX_DEPTH)
+        return (0);
+    j->size = (p->len * JIT_INSN_MAX + 1 + page - 1) / page * page;
+    code = mmap(NULL, j->size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        return (-1);
+    emit_program(p, code);
+    if (mprotect(code, j->size, PROT_READ | PROT_EXEC))
+        return (munmap(code, j->size), 0);
+    j->code = code;
+    j->fn = (vbc_jit_fn)(void *)code;
+    return (1);
+}
+
+#endif
+
+int     jit_compile(const node *tree, vbc_jit *j)
+{
+    int     ok;
+
+    j->fn = NULL;
+    j->code = NULL;
+    j->size = 0;
+    if (!compile_tree(tree, &j->prog))
+        return (-1);
+    ok = 0;
+#ifdef JIT_X86
+    ok = jit_native(&j->prog, j);
+#endif
+    if (ok)
+        free_program(&j->prog);
+    return (ok);
+}
+
+int     jit_call(const vbc_jit *j, const int *vars, int *res)
+{
+    if (!j->fn)
+        return (run_bound(&j->prog, vars, res));
+    *res = j->fn(vars);
+    return (1);
+}
+
+void    jit_free(vbc_jit *j)
+{
+    if (j->code)
+        munmap(j->code, j->size);
+    free_program(&j->prog);
+    j->fn = NULL;
+    j->code = NULL;
+    j->size = 0;
+}
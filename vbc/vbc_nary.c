@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vbc.h"
+
+// A run of operands joined by one operator becomes one node: the parser
+// keeps the operands of every open run on a stack and, when the run ends,
+// moves them to the end of the arrays in one block and pushes the node that
+// owns them in their place. A node is therefore stored after its children,
+// nothing is ever linked by pointer and the tree needs no recursion to walk.
+// Runs are reduced NARY_LANES at a time in GCC vectors.
+#define NARY_LANES 8
+
+typedef unsigned int    naryvec
+    __attribute__((vector_size(NARY_LANES * sizeof(unsigned int))));
+
+typedef struct nary_item {
+    unsigned char   type;
+    uint32_t        first;
+    uint32_t        n;
+    unsigned int    val;
+}   nary_item;
+
+// sum and prod are where the innermost open sum and product start on the
+// item stack; open saves the pair of every enclosing group.
+typedef struct nary_parser {
+    nary_tree   *t;
+    nary_item   *items;
+    size_t      nitems;
+    size_t      *open;
+    size_t      depth;
+    size_t      sum;
+    size_t      prod;
+}   nary_parser;
+
+void        nary_init(nary_tree *t)
+{
+    t->type = NULL;
+    t->first = NULL;
+    t->n = NULL;
+    t->val = NULL;
+    t->len = 0;
+    t->cap = 0;
+}
+
+void        nary_destroy(nary_tree *t)
+{
+    free(t->type);
+    free(t->first);
+    free(t->n);
+    free(t->val);
+    nary_init(t);
+}
+
+static int  nary_reserve(nary_tree *t, size_t cap)
+{
+    unsigned char   *type;
+    uint32_t        *first;
+    uint32_t        *n;
+    unsigned int    *val;
+
+    if (cap <= t->cap)
+        return (1);
+    type = realloc(t->type, cap);
+    if (type)
+        t->type = type;
+    first = type ? realloc(t->first, cap * sizeof(*first)) : NULL;
+    if (first)
+        t->first = first;
+    n = first ? realloc(t->n, cap * sizeof(*n)) : NULL;
+    if (n)
+        t->n = n;
+    val = n ? realloc(t->val, cap * sizeof(*val)) : NULL;
+    if (!val)
+        return (0);
+    t->val = val;
+    t->cap = cap;
+    return (1);
+}
+
+static void nary_append(nary_tree *t, const nary_item *it)
+{
+    t->type[t->len] = it->type;
+    t->first[t->len] = it->first;
+    t->n[t->len] = it->n;
+    t->val[t->len] = it->val;
+    t->len++;
+}
+
+// Replaces the items from start on, if there are several, by one node of
+// the given type owning them.
+static void nary_close(nary_parser *p, size_t start, int type)
+{
+    nary_item   *it;
+
+    if (p->nitems - start < 2)
+        return ;
+    it = &p->items[start];
+    while (it < p->items + p->nitems)
+        nary_append(p->t, it++);
+    it = &p->items[start];
+    it->type = (unsigned char)type;
+    it->first = (uint32_t)(p->t->len - (p->nitems - start));
+    it->n = (uint32_t)(p->nitems - start);
+    it->val = 0;
+    p->nitems = start + 1;
+}
+
+static void nary_loop(nary_parser *p, const char *s)
+{
+    while (1)
+    {
+        if (*s >= '0')
+        {
+            p->items[p->nitems].type = VAL;
+            p->items[p->nitems].first = 0;
+            p->items[p->nitems].n = 0;
+            p->items[p->nitems++].val = (unsigned int)(*s - '0');
+        }
+        else if (*s == '(')
+        {
+            p->open[2 * p->depth] = p->sum;
+            p->open[2 * p->depth++ + 1] = p->prod;
+            p->sum = p->nitems;
+            p->prod = p->nitems;
+        }
+        else if (*s == '+')
+        {
+            nary_close(p, p->prod, MULTI);
+            p->prod = p->nitems;
+        }
+        else if (*s != '*')
+        {
+            nary_close(p, p->prod, MULTI);
+            nary_close(p, p->sum, ADD);
+            if (!*s)
+                break ;
+            p->sum = p->open[2 * --p->depth];
+            p->prod = p->open[2 * p->depth + 1];
+        }
+        s++;
+    }
+    nary_append(p->t, &p->items[0]);
+}
+
+// Validated by vbc_scan_input first. An expression of len bytes has at most
+// len nodes and (len + 1) / 2 operands, so every array is sized up front.
+vbc_status  nary_parse(const char *s, nary_tree *t, vbc_error *err)
+{
+    vbc_scan    sc;
+    nary_parser p;
+
+    t->len = 0;
+    err->code = VBC_OK;
+    vbc_scan_input(s, 0, &sc);
+    if (!sc.valid)
+    {
+        err->code = s[sc.bad] ? VBC_EUNEXPECTED : VBC_EEND;
+        err->pos = sc.bad;
+        err->token = s[sc.bad];
+        return (err->code);
+    }
+    p.t = t;
+    p.items = malloc((sc.len / 2 + 1) * sizeof(*p.items));
+    p.open = malloc(2 * (sc.depth + 1) * sizeof(*p.open));
+    p.nitems = 0;
+    p.depth = 0;
+    p.sum = 0;
+    p.prod = 0;
+    if (sc.len < UINT32_MAX && p.items && p.open && nary_reserve(t, sc.len))
+        nary_loop(&p, s);
+    else
+        err->code = VBC_ENOMEM;
+    free(p.items);
+    free(p.open);
+    return (err->code);
+}
+
+static unsigned int nary_sum(const unsigned int *v, uint32_t n)
+{
+    naryvec         acc;
+    naryvec         x;
+    unsigned int    r;
+    uint32_t        i;
+    int             j;
+
+    r = 0;
+    i = 0;
+    if (n >= NARY_LANES)
+    {
+        acc = (naryvec){0};
+        while (i + NARY_LANES <= n)
+        {
+            memcpy(&x, v + i, sizeof(x));
+            acc += x;
+            i += NARY_LANES;
+        }
+        j = 0;
+        while (j < NARY_LANES)
+            r += acc[j++];
+    }
+    while (i < n)
+        r += v[i++];
+    return (r);
+}
+
+static unsigned int nary_product(const unsigned int *v, uint32_t n)
+{
+    naryvec         acc;
+    naryvec         x;
+    unsigned int    r;
+    uint32_t        i;
+    int             j;
+
+    r = 1;
+    i = 0;
+    if (n >= NARY_LANES)
+    {
+        acc = (naryvec){0} + 1;
+        while (i + NARY_LANES <= n)
+        {
+            memcpy(&x, v + i, sizeof(x));
+            acc *= x;
+            i += NARY_LANES;
+        }
+        j = 0;
+        while (j < NARY_LANES)
+            r *= acc[j++];
+    }
+    while (i < n)
+        r *= v[i++];
+    return (r);
+}
+
+int         nary_eval(nary_tree *t)
+{
+    size_t  i;
+
+    i = 0;
+    while (i < t->len)
+    {
+        if (t->type[i] == ADD)
+            t->val[i] = nary_sum(t->val + t->first[i], t->n[i]);
+        else if (t->type[i] == MULTI)
+            t->val[i] = nary_product(t->val + t->first[i], t->n[i]);
+        i++;
+    }
+    return ((int)t->val[t->len - 1]);
+}
@@ -0,0 +1,574 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "vbc.h"
+
+// Parallel evaluation with lazily split tasks on work-stealing deques.
+//
+// Each thread evaluates with an explicit stack of frames, so any depth is
+// fine. Every cutoff nodes it checks whether a thread is idle and, if one is,
+// gives away the oldest pending work on its stack, which is the biggest:
+// - a run of left-leaning frames of one operator, such as the spine of a long
+//   sum, whose right operands are still to come: the rootward half of them
+//   becomes a task, combined with the run's left value when that is known;
+// - the untouched upper half of a task's own operand range.
+// Wrapping + and * are associative and commutative, so operands may be
+// combined in any grouping and order and the result is eval_tree's. Nothing
+// is split without an idle thread, so a lone thread runs sequentially.
+#define PAR_DEQUE 4096
+
+typedef struct task {
+    atomic_int      done;
+    const node      **ops;
+    size_t          n;
+    int             type;
+    int             owned;  // ops was allocated for this task
+    unsigned int    res;
+    struct task     *next;  // further donations from the same range frame
+}   task;
+
+typedef struct deque {
+    pthread_mutex_t lock;
+    task            *slot[PAR_DEQUE];
+    size_t          top;    // next to steal
+    size_t          bottom; // next free
+}   deque;
+
+typedef struct pool {
+    deque           *q;
+    int             n;
+    size_t          cutoff;
+    atomic_int      idle;
+    atomic_int      stop;
+    atomic_int      oom;
+}   pool;
+
+// A node frame waits for the left, then the right value of n. A range frame
+// (n is NULL) combines ops[i] up to end.
+typedef struct pframe {
+    const node      *n;
+    const node      **ops;
+    size_t          i;
+    size_t          end;
+    unsigned int    acc;
+    int             type;
+    int             right;      // evaluating n->r
+    int             covered;    // n->r was given away by a frame above
+    size_t          span;       // frames popped once donated is joined
+    task            *donated;
+}   pframe;
+
+typedef struct estack {
+    pframe  *f;
+    size_t  sp;
+    size_t  cap;
+    size_t  low;    // frames below have nothing left to give away
+    size_t  tick;
+}   estack;
+
+typedef struct worker {
+    pool    *p;
+    int     self;
+}   worker;
+
+static unsigned int combine(int type, unsigned int a, unsigned int b)
+{
+    return (type == ADD ? a + b : a * b);
+}
+
+static int      push(pool *p, int self, task *t)
+{
+    deque   *q;
+    int     ok;
+
+    q = &p->q[self];
+    pthread_mutex_lock(&q->lock);
+    ok = q->bottom - q->top < PAR_DEQUE;
+    if (ok)
+        q->slot[q->bottom++ % PAR_DEQUE] = t;
+    pthread_mutex_unlock(&q->lock);
+    return (ok);
+}
+
+// The owner takes its newest task; thieves take the oldest, which is the
+// biggest piece of work left in that deque.
+static task     *take(pool *p, int self, int victim)
+{
+    deque   *q;
+    task    *t;
+
+    q = &p->q[victim];
+    t = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->bottom != q->top && victim == self)
+        t = q->slot[--q->bottom % PAR_DEQUE];
+    else if (q->bottom != q->top)
+        t = q->slot[q->top++ % PAR_DEQUE];
+    pthread_mutex_unlock(&q->lock);
+    return (t);
+}
+
+static task     *find(pool *p, int self)
+{
+    task    *t;
+    int     i;
+
+    t = take(p, self, self);
+    i = 1;
+    while (!t && i < p->n)
+        t = take(p, self, (self + i++) % p->n);
+    return (t);
+}
+
+static void     estack_init(estack *st)
+{
+    st->f = NULL;
+    st->sp = 0;
+    st->cap = 0;
+    st->low = 0;
+    st->tick = 0;
+}
+
+static int      push_frame(estack *st, const node *n, const node **ops,
+                    size_t end)
+{
+    pframe  *f;
+
+    if (st->sp == st->cap)
+    {
+        f = realloc(st->f, (st->cap ? st->cap * 2 : 64) * sizeof(*f));
+        if (!f)
+            return (0);
+        st->f = f;
+        st->cap = st->cap ? st->cap * 2 : 64;
+    }
+    f = &st->f[st->sp++];
+    f->n = n;
+    f->ops = ops;
+    f->i = 0;
+    f->end = end;
+    f->acc = 0;
+    f->type = n ? n->type : 0;
+    f->right = 0;
+    f->covered = 0;
+    f->span = 0;
+    f->donated = NULL;
+    return (1);
+}
+
+static task     *new_task(const node **ops, size_t n, int type, int owned)
+{
+    task    *t;
+
+    t = malloc(sizeof(*t));
+    if (!t)
+        return (NULL);
+    atomic_init(&t->done, 0);
+    t->ops = ops;
+    t->n = n;
+    t->type = type;
+    t->owned = owned;
+    t->res = 0;
+    t->next = NULL;
+    return (t);
+}
+
+static void     free_task(task *t)
+{
+    if (t->owned)
+        free(t->ops);
+    free(t);
+}
+
+static int      give_range(pool *p, int self, pframe *f)
+{
+    task    *t;
+    size_t  left;
+    size_t  mid;
+
+    left = f->end - f->i - 1;
+    if (!left || (left == 1 && f->ops[f->end - 1]->type >= VAL))
+        return (0);
+    mid = f->i + 1 + left / 2;
+    t = new_task(f->ops + mid, f->end - mid, f->type, 0);
+    if (!t || !push(p, self, t))
+        return (free(t), 0);
+    f->end = mid;
+    t->next = f->donated;
+    f->donated = t;
+    return (1);
+}
+
+// f[0..m) are left-leaning frames of one operator, each waiting for the
+// left value of the one below it. The right operands of the rootward half go
+// to one task, joined by the topmost frame of that half.
+static int      give_run(pool *p, int self, pframe *f, size_t m)
+{
+    task        *t;
+    const node  **ops;
+    size_t      h;
+    size_t      j;
+
+    if (m < 2 && f->n->r->type >= VAL)
+        return (0);
+    h = (m + 1) / 2;
+    ops = malloc(h * sizeof(*ops));
+    t = ops ? new_task(ops, h, f->type, 1) : NULL;
+    j = 0;
+    while (t && j < h)
+    {
+        ops[j] = f[j].n->r;
+        j++;
+    }
+    if (!t || !push(p, self, t))
+        return (free(ops), free(t), 0);
+    while (j-- > 1)
+        f[j - 1].covered = 1;
+    f[h - 1].donated = t;
+    f[h - 1].span = h;
+    return (1);
+}
+
+static int      waiting_left(const pframe *f)
+{
+    return (f->n && !f->right && !f->covered && !f->donated);
+}
+
+static void     donate(pool *p, int self, estack *st)
+{
+    pframe  *f;
+    size_t  k;
+    size_t  m;
+
+    k = st->low;
+    while (k < st->sp)
+    {
+        f = &st->f[k];
+        if (!f->n && give_range(p, self, f))
+            return ;
+        m = 0;
+        while (k + m < st->sp && waiting_left(&f[m]) && f[m].type == f->type)
+            m++;
+        if (m && give_run(p, self, f, m))
+            return ;
+        if (k == st->low)
+            st->low++;
+        k++;
+    }
+}
+
+static void     run_task(pool *p, int self, task *t);
+
+// Runs other tasks until *flag is set, counting itself idle while there are
+// none, which is what makes busy threads split their work.
+static void     work_until(pool *p, int self, atomic_int *flag)
+{
+    task    *t;
+    int     idle;
+
+    idle = 0;
+    while (!atomic_load_explicit(flag, memory_order_acquire))
+    {
+        t = find(p, self);
+        if (t)
+        {
+            if (idle)
+                atomic_fetch_sub(&p->idle, 1);
+            idle = 0;
+            run_task(p, self, t);
+        }
+        else if (!idle)
+        {
+            atomic_fetch_add(&p->idle, 1);
+            idle = 1;
+        }
+        else
+            sched_yield();
+    }
+    if (idle)
+        atomic_fetch_sub(&p->idle, 1);
+}
+
+static unsigned int join(pool *p, int self, task *t)
+{
+    unsigned int    res;
+
+    work_until(p, self, &t->done);
+    res = t->res;
+    free_task(t);
+    return (res);
+}
+
+// Joins everything given away from the stack after a failed allocation.
+static int      abandon(pool *p, int self, estack *st)
+{
+    task    *t;
+
+    atomic_store(&p->oom, 1);
+    while (st->sp)
+    {
+        st->sp--;
+        while ((t = st->f[st->sp].donated))
+        {
+            st->f[st->sp].donated = t->next;
+            join(p, self, t);
+        }
+    }
+    return (0);
+}
+
+// Hands the value v to the frame on top. Returns 1 if that frame needs
+// another value, 0 if it is done and popped, with its own value in v.
+static int      settle(pool *p, int self, estack *st, unsigned int *v)
+{
+    pframe  *f;
+    task    *t;
+
+    f = &st->f[st->sp - 1];
+    if (!f->n)
+    {
+        f->acc = f->i ? combine(f->type, f->acc, *v) : *v;
+        if (++f->i < f->end)
+            return (1);
+        *v = f->acc;
+        while ((t = f->donated))
+        {
+            f->donated = t->next;
+            *v = combine(f->type, *v, join(p, self, t));
+        }
+        st->sp--;
+    }
+    else if (!f->right && f->donated)
+    {
+        *v = combine(f->type, *v, join(p, self, f->donated));
+        st->sp -= f->span;
+    }
+    else if (!f->right)
+    {
+        f->acc = *v;
+        f->right = 1;
+        return (1);
+    }
+    else
+    {
+        *v = combine(f->type, f->acc, *v);
+        st->sp--;
+    }
+    if (st->low > st->sp)
+        st->low = st->sp;
+    return (0);
+}
+
+static int      eval_stack(pool *p, int self, estack *st, unsigned int *res)
+{
+    const node      *n;
+    pframe          *f;
+    unsigned int    v;
+
+    v = 0;
+    while (st->sp)
+    {
+        f = &st->f[st->sp - 1];
+        n = !f->n ? f->ops[f->i] : f->right ? f->n->r : f->n->l;
+        if (++st->tick >= p->cutoff)
+        {
+            st->tick = 0;
+            if (atomic_load_explicit(&p->idle, memory_order_relaxed))
+                donate(p, self, st);
+        }
+        if (n->type < VAL)
+        {
+            if (!push_frame(st, n, NULL, 0))
+                return (abandon(p, self, st));
+            continue ;
+        }
+        v = n->type == VAL ? (unsigned int)n->val : 0;
+        while (st->sp && !settle(p, self, st, &v))
+            ;
+    }
+    *res = v;
+    return (1);
+}
+
+static void     run_task(pool *p, int self, task *t)
+{
+    estack  st;
+
+    estack_init(&st);
+    if (!push_frame(&st, NULL, t->ops, t->n))
+        atomic_store(&p->oom, 1);
+    else
+    {
+        st.f[0].type = t->type;
+        eval_stack(p, self, &st, &t->res);
+    }
+    free(st.f);
+    atomic_store_explicit(&t->done, 1, memory_order_release);
+}
+
+// eval_tree, given up once more than *budget nodes have been visited. The
+// budget also bounds the recursion depth.
+static unsigned int eval_budget(const node *n, long *budget)
+{
+    if (--*budget < 0)
+        return (0);
+    if (n->type >= VAL)
+        return (n->type == VAL ? (unsigned int)n->val : 0);
+    if (n->type == ADD)
+        return (eval_budget(n->l, budget) + eval_budget(n->r, budget));
+    return (eval_budget(n->l, budget) * eval_budget(n->r, budget));
+}
+
+// The threads are started by the first call that needs them and then sleep
+// between calls. A call takes the whole pool: gen wakes the workers, and it
+// returns only once every one of them has left the evaluation, so the deques
+// can be reset for the next. A call made while the pool is busy, or in a
+// child forked after it was started, evaluates serially.
+typedef struct par_pool {
+    pthread_mutex_t busy;
+    pthread_mutex_t m;
+    pthread_cond_t  wake;
+    pthread_cond_t  done;
+    pool            p;
+    worker          *w;
+    pthread_t       *th;
+    int             size;
+    int             started;
+    int             finished;
+    unsigned long   gen;
+    pid_t           pid;
+}   par_pool;
+
+static par_pool g_par = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, {0}, NULL, NULL, 0, 0,
+    0, 0, 0};
+
+static void     *worker_main(void *arg)
+{
+    worker          *w;
+    unsigned long   seen;
+
+    w = arg;
+    seen = 0;
+    pthread_mutex_lock(&g_par.m);
+    while (1)
+    {
+        while (g_par.gen == seen)
+            pthread_cond_wait(&g_par.wake, &g_par.m);
+        seen = g_par.gen;
+        pthread_mutex_unlock(&g_par.m);
+        if (w->self < w->p->n)
+            work_until(w->p, w->self, &w->p->stop);
+        pthread_mutex_lock(&g_par.m);
+        if (++g_par.finished == g_par.started)
+            pthread_cond_signal(&g_par.done);
+    }
+    return (NULL);
+}
+
+// Called with busy held. Slot 0 is the caller's; the deques of threads that
+// failed to start stay empty.
+static int      par_start(int nthreads)
+{
+    int i;
+
+    g_par.p.q = malloc(nthreads * sizeof(*g_par.p.q));
+    g_par.w = malloc(nthreads * sizeof(*g_par.w));
+    g_par.th = malloc(nthreads * sizeof(*g_par.th));
+    if (!g_par.p.q || !g_par.w || !g_par.th)
+    {
+        free(g_par.p.q);
+        free(g_par.w);
+        free(g_par.th);
+        return (0);
+    }
+    i = 0;
+    while (i < nthreads)
+    {
+        pthread_mutex_init(&g_par.p.q[i].lock, NULL);
+        g_par.w[i].p = &g_par.p;
+        g_par.w[i].self = i;
+        i++;
+    }
+    g_par.size = nthreads;
+    g_par.pid = getpid();
+    pthread_mutex_lock(&g_par.m);
+    while (g_par.started + 1 < nthreads && pthread_create(
+            &g_par.th[g_par.started + 1], NULL, worker_main,
+            &g_par.w[g_par.started + 1]) == 0)
+        g_par.started++;
+    pthread_mutex_unlock(&g_par.m);
+    return (1);
+}
+
+static int      par_run(const node *tree, int nthreads, size_t cutoff,
+                    int *res)
+{
+    estack          st;
+    unsigned int    v;
+    int             i;
+
+    pthread_mutex_lock(&g_par.m);
+    g_par.p.n = nthreads < g_par.size ? nthreads : g_par.size;
+    g_par.p.cutoff = cutoff ? cutoff : 1;
+    atomic_store(&g_par.p.idle, 0);
+    atomic_store(&g_par.p.stop, 0);
+    atomic_store(&g_par.p.oom, 0);
+    i = 0;
+    while (i < g_par.size)
+    {
+        g_par.p.q[i].top = 0;
+        g_par.p.q[i++].bottom = 0;
+    }
+    g_par.finished = 0;
+    g_par.gen++;
+    pthread_cond_broadcast(&g_par.wake);
+    pthread_mutex_unlock(&g_par.m);
+    estack_init(&st);
+    if (push_frame(&st, tree, NULL, 0) && eval_stack(&g_par.p, 0, &st, &v))
+        *res = (int)v;
+    else
+        atomic_store(&g_par.p.oom, 1);
+    free(st.f);
+    atomic_store(&g_par.p.stop, 1);
+    pthread_mutex_lock(&g_par.m);
+    while (g_par.finished < g_par.started)
+        pthread_cond_wait(&g_par.done, &g_par.m);
+    pthread_mutex_unlock(&g_par.m);
+    return (!atomic_load(&g_par.p.oom));
+}
+
+static int      eval_serial(const node *tree, int *res)
+{
+    program p;
+    int     ok;
+
+    ok = compile_tree(tree, &p) && run_program(&p, res);
+    free_program(&p);
+    return (ok);
+}
+
+// Trees within the cutoff are evaluated on the spot, and a single thread
+// runs the bytecode, which costs less than the stealing machinery.
+int     eval_parallel(const node *tree, int nthreads, size_t cutoff, int *res)
+{
+    long    budget;
+    int     ok;
+
+    budget = (long)cutoff;
+    *res = (int)eval_budget(tree, &budget);
+    if (budget >= 0)
+        return (1);
+    if (nthreads <= 1 || pthread_mutex_trylock(&g_par.busy))
+        return (eval_serial(tree, res));
+    if (g_par.size ? g_par.pid != getpid() : !par_start(nthreads))
+    {
+        pthread_mutex_unlock(&g_par.busy);
+        return (eval_serial(tree, res));
+    }
+    ok = par_run(tree, nthreads, cutoff, res);
+    pthread_mutex_unlock(&g_par.busy);
+    return (ok);
+}
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "vbc.h"
+
+// Records the first error only: at is the offending character, or NULL after
+// an allocation failure.
+static vbc_status   set_error(vbc_error *err, const char *start, const char *at)
+{
+    if (err->code != VBC_OK)
+        return (err->code);
+    if (!at)
+        err->code = VBC_ENOMEM;
+    else
+    {
+        err->code = *at ? VBC_EUNEXPECTED : VBC_EEND;
+        err->pos = at - start;
+        err->token = *at;
+    }
+    return (err->code);
+}
+
+static void         clear_error(vbc_error *err)
+{
+    err->code = VBC_OK;
+    err->pos = 0;
+    err->token = '\0';
+}
+
+// A token that would not print as itself, such as a NUL or a blank line in
+// a stream, is escaped so that the message stays on one readable line.
+int     vbc_strerror(const vbc_error *err, char *buf, size_t size)
+{
+    unsigned char   c;
+
+    c = (unsigned char)err->token;
+    if (err->code == VBC_EUNEXPECTED && c == '\0')
+        return (snprintf(buf, size, "Unexpected token '\\0'"));
+    if (err->code == VBC_EUNEXPECTED && c == '\n')
+        return (snprintf(buf, size, "Unexpected token '\\n'"));
+    if (err->code == VBC_EUNEXPECTED && !isprint(c))
+        return (snprintf(buf, size, "Unexpected token '\\x%02x'", c));
+    if (err->code == VBC_EUNEXPECTED)
+        return (snprintf(buf, size, "Unexpected token '%c'", c));
+    if (err->code == VBC_EEND)
+        return (snprintf(buf, size, "Unexpected end of input"));
+    if (err->code == VBC_ENOMEM)
+        return (snprintf(buf, size, "Out of memory"));
+    if (err->code == VBC_EIO)
+        return (snprintf(buf, size, "Read error"));
+    return (snprintf(buf, size, "OK"));
+}
+
+// Recursive descent, as in the subject's skeleton.
+typedef struct rparser {
+    const char  *s;
+    const char  *start;
+    arena       *a;
+    vbc_error   *err;
+}   rparser;
+
+static node *parse_addition(rparser *p);
+static node *parse_multiplication(rparser *p);
+
+static node *parse_fail_at(rparser *p, const char *at)
+{
+    set_error(p->err, p->start, at);
+    return (NULL);
+}
+
+static node *parse_number_or_group(rparser *p)
+{
+    node    *res;
+    node    tmp;
+
+    res = NULL;
+    if (*p->s == '(')
+    {
+        p->s++;
+        res = parse_addition(p);
+        if (!res || *p->s != ')')
+            return (parse_fail_at(p, p->s));
+        p->s++;
+        return (res);
+    }
+    if (isdigit(*p->s))
+    {
+        tmp.type = VAL;
+        tmp.val = *p->s - '0';
+        res = new_node(p->a, tmp);
+        if (!res)
+            return (parse_fail_at(p, NULL));
+        p->s++;
+        return (res);
+    }
+    return (parse_fail_at(p, p->s));
+}
+
+static node *parse_multiplication(rparser *p)
+{
+    node    *left;
+    node    *right;
+    node    tmp;
+
+    left = parse_number_or_group(p);
+    if (!left)
+        return (NULL);
+    while (*p->s == '*')
+    {
+        p->s++;
+        right = parse_number_or_group(p);
+        if (!right)
+            return (NULL);
+        tmp.type = MULTI;
+        tmp.l = left;
+        tmp.r = right;
+        left = new_node(p->a, tmp);
+        if (!left)
+            return (parse_fail_at(p, NULL));
+    }
+    return (left);
+}
+
+static node *parse_addition(rparser *p)
+{
+    node    *left;
+    node    *right;
+    node    tmp;
+
+    left = parse_multiplication(p);
+    if (!left)
+        return (NULL);
+    while (*p->s == '+')
+    {
+        p->s++;
+        right = parse_multiplication(p);
+        if (!right)
+            return (NULL);
+        tmp.type = ADD;
+        tmp.l = left;
+        tmp.r = right;
+        left = new_node(p->a, tmp);
+        if (!left)
+            return (parse_fail_at(p, NULL));
+    }
+    return (left);
+}
+
+vbc_status  vbc_parse_recursive(const char *s, arena *a, node **root,
+                vbc_error *err)
+{
+    rparser     p;
+    vbc_scan    sc;
+
+    clear_error(err);
+    *root = NULL;
+    vbc_scan_input(s, 0, &sc);
+    if (sc.close != sc.len)
+        return (set_error(err, s, s + sc.close));
+    p.s = s;
+    p.start = s;
+    p.a = a;
+    p.err = err;
+    *root = parse_addition(&p);
+    if (*root && *p.s)
+        *root = parse_fail_at(&p, p.s);
+    return (err->code);
+}
+
+// Explicit-stack parser: operator precedence with heap operand and operator
+// stacks, so nesting depth is bounded by memory, not by the C stack. Input is
+// validated by vbc_scan_input first, so the loop checks nothing, and the
+// stacks are sized once: each open group holds at most its '(', a pending '+'
+// and '*', and three operands.
+// When simplifying, marks[i] is where the subtree of vals[i] starts in the
+// arena. A group's first operand is allocated right after its '(', which
+// allocates nothing, so that mark is also the start of the whole group.
+typedef struct pstack {
+    node        **vals;
+    arena_mark  *marks;
+    char        *ops;
+    size_t      nvals;
+    size_t      nops;
+}   pstack;
+
+static int  pstack_init(pstack *st, size_t depth, int simplify)
+{
+    size_t  cap;
+
+    cap = 3 * (depth + 1);
+    st->vals = malloc(cap * sizeof(*st->vals));
+    st->marks = simplify ? malloc(cap * sizeof(*st->marks)) : NULL;
+    st->ops = malloc(cap);
+    st->nvals = 0;
+    st->nops = 0;
+    return (st->vals && st->ops && (st->marks || !simplify));
+}
+
+// Reads the number at *s, leaving *s on its last digit. Eight bytes are
+// loaded at a time while they are all inside the input: the first non-digit
+// is the lowest byte with a high nibble left after subtracting '0' or adding
+// 6 (borrows and carries only travel upwards, past the digits), shifting left
+// drops it and what follows in favour of leading zeros, and three multiplies
+// combine the digits pairwise into the chunk's value.
+static uint64_t     read_number(const char **s, const char *end)
+{
+    static const uint64_t   pow10[9] = {1, 10, 100, 1000, 10000, 100000,
+        1000000, 10000000, 100000000};
+    const char              *p;
+    uint64_t                v;
+    uint64_t                c;
+    uint64_t                x;
+    int                     n;
+
+    p = *s;
+    v = 0;
+    n = 8;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (n == 8 && end - p >= 8)
+    {
+        memcpy(&c, p, 8);
+        x = c - 0x3030303030303030u;
+        x = (x | (x + 0x0606060606060606u)) & 0xF0F0F0F0F0F0F0F0u;
+        n = x ? __builtin_ctzll(x) / 8 : 8;
+        if (!n)
+            break ;
+        c = (c << (8 * (8 - n))) & 0x0F0F0F0F0F0F0F0Fu;
+        c = (c * 10 + (c >> 8)) & 0x00FF00FF00FF00FFu;
+        c = (c * 100 + (c >> 16)) & 0x0000FFFF0000FFFFu;
+        c = (c * 10000 + (c >> 32)) & 0xFFFFFFFFu;
+        v = v * pow10[n] + c;
+        p += n;
+    }
+#endif
+    while (n == 8 && *p >= '0' && *p <= '9')
+        v = v * 10 + (uint64_t)(*p++ - '0');
+    *s = p - 1;
+    return (v);
+}
+
+node    *vbc_make(const vbc_build *b, node n)
+{
+    if (b->dag)
+        return (hashcons_node(b->dag, b->a, n));
+    return (new_node(b->a, n));
+}
+
+static int  reduce(pstack *st, const vbc_build *b)
+{
+    node    tmp;
+    node    *res;
+
+    tmp.type = st->ops[--st->nops] == '+' ? ADD : MULTI;
+    tmp.val = 0;
+    tmp.r = st->vals[--st->nvals];
+    tmp.l = st->vals[st->nvals - 1];
+    if (b->flags & VBC_SIMPLIFY)
+        res = simplify(b, tmp, st->marks[st->nvals - 1], st->marks[st->nvals]);
+    else
+        res = vbc_make(b, tmp);
+    if (!res)
+        return (0);
+    st->vals[st->nvals - 1] = res;
+    return (1);
+}
+
+static vbc_status   parse_fail(pstack *st, vbc_error *err, const char *start,
+                        const char *at)
+{
+    free(st->vals);
+    free(st->marks);
+    free(st->ops);
+    return (set_error(err, start, at));
+}
+
+vbc_status  vbc_parse(const char *s, arena *a, node **root, vbc_error *err)
+{
+    vbc_build   b;
+
+    b.a = a;
+    b.dag = NULL;
+    b.flags = 0;
+    return (vbc_parse_ex(s, &b, root, err));
+}
+
+vbc_status  vbc_parse_ex(const char *s, const vbc_build *b, node **root,
+                vbc_error *err)
+{
+    const char  *start;
+    vbc_scan    sc;
+    pstack      st;
+    node        tmp;
+    int         numbers;
+
+    clear_error(err);
+    *root = NULL;
+    vbc_scan_input(s, b->flags, &sc);
+    if (!sc.valid)
+        return (set_error(err, s, s + sc.bad));
+    start = s;
+    numbers = (b->flags & VBC_NUMBERS) && sc.multi;
+    if (!pstack_init(&st, sc.depth, b->flags & VBC_SIMPLIFY))
+        return (parse_fail(&st, err, start, NULL));
+    tmp.l = NULL;
+    tmp.r = NULL;
+    while (1)
+    {
+        if (*s >= '0')
+        {
+            tmp.type = *s >= 'a' ? VAR : VAL;
+            tmp.val = *s - (*s >= 'a' ? 'a' : '0');
+            if (numbers && *s <= '9')
+                tmp.val = (int)(unsigned int)read_number(&s, start + sc.len);
+            if (b->flags & VBC_SIMPLIFY)
+                st.marks[st.nvals] = arena_get_mark(b->a);
+            st.vals[st.nvals] = vbc_make(b, tmp);
+            if (!st.vals[st.nvals++])
+                return (parse_fail(&st, err, start, NULL));
+        }
+        else if (*s == '(')
+            st.ops[st.nops++] = '(';
+        else if (*s == '+' || *s == '*')
+        {
+            while (st.nops && st.ops[st.nops - 1] != '('
+                && (*s == '+' || st.ops[st.nops - 1] == '*'))
+                if (!reduce(&st, b))
+                    return (parse_fail(&st, err, start, NULL));
+            st.ops[st.nops++] = *s;
+        }
+        else
+        {
+            while (st.nops && st.ops[st.nops - 1] != '(')
+                if (!reduce(&st, b))
+                    return (parse_fail(&st, err, start, NULL));
+            if (!*s)
+                break ;
+            st.nops--;
+        }
+        s++;
+    }
+    *root = st.vals[0];
+    free(st.vals);
+    free(st.marks);
+    free(st.ops);
+    return (VBC_OK);
+}
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include "vbc.h"
+
+// A node is 9 bytes spread over three arrays instead of a 24-byte struct, and
+// the arrays grow by doubling, so a tree of n nodes costs O(log n) reallocs.
+// The parser appends every node after its operands, left subtree first, so
+// the arrays hold the tree in postorder and pool_eval is one sequential pass
+// with a value stack, as run_program is over bytecode.
+void        pool_init(node_pool *p)
+{
+    p->type = NULL;
+    p->l = NULL;
+    p->r = NULL;
+    p->n = 0;
+    p->cap = 0;
+    p->root = 0;
+    p->depth = 0;
+}
+
+void        pool_destroy(node_pool *p)
+{
+    free(p->type);
+    free(p->l);
+    free(p->r);
+    pool_init(p);
+}
+
+static int  pool_grow(node_pool *p)
+{
+    unsigned char   *type;
+    uint32_t        *l;
+    uint32_t        *r;
+    uint32_t        cap;
+
+    if (p->cap > POOL_MAX / 2)
+        return (0);
+    cap = p->cap ? p->cap * 2 : 1024;
+    type = realloc(p->type, cap);
+    if (type)
+        p->type = type;
+    l = type ? realloc(p->l, cap * sizeof(*l)) : NULL;
+    if (l)
+        p->l = l;
+    r = l ? realloc(p->r, cap * sizeof(*r)) : NULL;
+    if (!r)
+        return (0);
+    p->r = r;
+    p->cap = cap;
+    return (1);
+}
+
+// Returns the new node's index, POOL_MAX if the pool is full.
+static uint32_t pool_add(node_pool *p, int type, uint32_t l, uint32_t r)
+{
+    if (p->n == p->cap && !pool_grow(p))
+        return (POOL_MAX);
+    p->type[p->n] = (unsigned char)type;
+    p->l[p->n] = l;
+    p->r[p->n] = r;
+    return (p->n++);
+}
+
+typedef struct pool_stack {
+    uint32_t    *vals;
+    char        *ops;
+    size_t      nvals;
+    size_t      nops;
+}   pool_stack;
+
+static int  pool_reduce(node_pool *p, pool_stack *st)
+{
+    uint32_t    r;
+
+    r = st->vals[--st->nvals];
+    st->vals[st->nvals - 1] = pool_add(p,
+            st->ops[--st->nops] == '+' ? ADD : MULTI,
+            st->vals[st->nvals - 1], r);
+    return (st->vals[st->nvals - 1] != POOL_MAX);
+}
+
+static int  pool_loop(node_pool *p, pool_stack *st, const char *s)
+{
+    while (1)
+    {
+        if (*s >= '0')
+        {
+            st->vals[st->nvals] = pool_add(p, VAL, (uint32_t)(*s - '0'), 0);
+            if (st->vals[st->nvals++] == POOL_MAX)
+                return (0);
+            if (st->nvals > p->depth)
+                p->depth = st->nvals;
+        }
+        else if (*s == '(')
+            st->ops[st->nops++] = '(';
+        else if (*s == '+' || *s == '*')
+        {
+            while (st->nops && st->ops[st->nops - 1] != '('
+                && (*s == '+' || st->ops[st->nops - 1] == '*'))
+                if (!pool_reduce(p, st))
+                    return (0);
+            st->ops[st->nops++] = *s;
+        }
+        else
+        {
+            while (st->nops && st->ops[st->nops - 1] != '(')
+                if (!pool_reduce(p, st))
+                    return (0);
+            if (!*s)
+                return (1);
+            st->nops--;
+        }
+        s++;
+    }
+}
+
+// The same precedence parser as vbc_parse_ex, emitting indices. The pool is
+// emptied first, so one pool can be reused across expressions.
+vbc_status  pool_parse(const char *s, node_pool *p, vbc_error *err)
+{
+    vbc_scan    sc;
+    pool_stack  st;
+    int         ok;
+
+    p->n = 0;
+    p->depth = 0;
+    err->code = VBC_OK;
+    vbc_scan_input(s, 0, &sc);
+    if (!sc.valid)
+    {
+        err->code = s[sc.bad] ? VBC_EUNEXPECTED : VBC_EEND;
+        err->pos = sc.bad;
+        err->token = s[sc.bad];
+        return (err->code);
+    }
+    st.vals = malloc(3 * (sc.depth + 1) * sizeof(*st.vals));
+    st.ops = malloc(3 * (sc.depth + 1));
+    st.nvals = 0;
+    st.nops = 0;
+    ok = st.vals && st.ops && pool_loop(p, &st, s);
+    if (ok)
+        p->root = st.vals[0];
+    else
+        err->code = VBC_ENOMEM;
+    free(st.vals);
+    free(st.ops);
+    return (err->code);
+}
+
+int         pool_eval(const node_pool *p, int *res)
+{
+    unsigned int    buf[256];
+    unsigned int    *st;
+    size_t          sp;
+    uint32_t        i;
+
+    st = buf;
+    if (p->depth > sizeof(buf) / sizeof(*buf))
+    {
+        st = malloc(p->depth * sizeof(*st));
+        if (!st)
+            return (0);
+    }
+    st[0] = 0;
+    sp = 0;
+    i = 0;
+    while (i < p->n)
+    {
+        if (p->type[i] == VAL)
+            st[sp++] = p->l[i];
+        else if (p->type[i] == ADD)
+        {
+            sp--;
+            st[sp - 1] += st[sp];
+        }
+        else
+        {
+            sp--;
+            st[sp - 1] *= st[sp];
+        }
+        i++;
+    }
+    *res = (int)st[0];
+    if (st != buf)
+        free(st);
+    return (1);
+}
@@ -0,0 +1,277 @@
+#include <stdint.h>
+#include <string.h>
+#include "vbc.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+# include <immintrin.h>
+# define SCAN_X86 1
+#endif
+
+// One pass over the input that checks everything the parser would. A byte
+// that starts an operand (digit or '(') must follow one that does not end an
+// operand (anything but a digit or ')'), and every other byte must follow one
+// that does, so with a = "ends an operand" and b = "starts an operand" the
+// rule is prev_a != b at every offset. That, the alphabet and the depth never
+// dropping below zero make the first failure exactly where the parser fails,
+// except that a ')' closing nothing is reported wherever it is, as the
+// subject's check_balance does before parsing.
+// Under VBC_VARS a lowercase letter is an operand just like a digit. Under
+// VBC_NUMBERS a decimal digit may also follow a decimal digit, which makes
+// the two one number; multi records whether any such run exists.
+#define SCAN_NONE ((size_t)-1)
+
+typedef struct scan_ctx {
+    const char  *s;
+    size_t      depth;
+    size_t      max;
+    size_t      bad;
+    size_t      close;
+    int         prev_a;
+    int         prev_num;
+    int         vars;
+    int         numbers;
+    int         multi;
+}   scan_ctx;
+
+// Scanning stops at the first ')' that closes nothing: every error is known.
+static void scan_byte(scan_ctx *x, size_t i)
+{
+    unsigned char   c;
+    int             digit;
+    int             num;
+    int             a;
+    int             b;
+
+    c = (unsigned char)x->s[i];
+    num = x->numbers && c >= '0' && c <= '9';
+    digit = (c >= '0' && c <= '9') || (x->vars && c >= 'a' && c <= 'z');
+    a = digit || c == ')';
+    b = digit || c == '(';
+    x->multi |= num && x->prev_num;
+    if (x->bad == SCAN_NONE && ((!a && !b && c != '+' && c != '*')
+        || (x->prev_a == b && !(num && x->prev_num))))
+        x->bad = i;
+    x->prev_a = a;
+    x->prev_num = num;
+    if (c == '(' && ++x->depth > x->max)
+        x->max = x->depth;
+    else if (c == ')' && x->depth-- == 0)
+    {
+        x->close = i;
+        if (x->bad == SCAN_NONE)
+            x->bad = i;
+    }
+}
+
+#ifdef SCAN_X86
+
+// Folds one block of w bytes, none of them NUL, from its bit masks and the
+// lowest, highest and final depth reached inside it. A block that closes more
+// than is open is redone byte by byte to find the offending ')'. n is the
+// mask of digits that may continue a number. Returns 0 once that ')' is found.
+__attribute__((always_inline))
+static inline int   scan_block(scan_ctx *x, size_t i, int w, uint32_t a, uint32_t b,
+                uint32_t n, uint32_t ok, int lo, int hi, int sum)
+{
+    uint32_t    full;
+    uint32_t    run;
+    uint32_t    bad;
+    int         j;
+
+    if (lo < 0 && (size_t)-lo > x->depth)
+    {
+        j = 0;
+        while (j < w && x->close == SCAN_NONE)
+            scan_byte(x, i + j++);
+        return (x->close == SCAN_NONE);
+    }
+    full = w == 32 ? 0xFFFFFFFFu : (1u << w) - 1;
+    run = n & ((n << 1) | (uint32_t)x->prev_num);
+    x->multi |= run != 0;
+    bad = (~ok | (~(((a << 1) | (uint32_t)x->prev_a) ^ b) & ~run)) & full;
+    if (bad && x->bad == SCAN_NONE)
+        x->bad = i + __builtin_ctz(bad);
+    if (hi > 0 && x->depth + hi > x->max)
+        x->max = x->depth + hi;
+    x->depth += sum;
+    x->prev_a = (a >> (w - 1)) & 1;
+    x->prev_num = (n >> (w - 1)) & 1;
+    return (1);
+}
+
+// Signed byte minimum and maximum of v, through the unsigned ones. Inlined so
+// that the AVX2 loop gets VEX encodings and no SSE transition penalties.
+__attribute__((always_inline))
+static inline void  hminmax(__m128i v, int *lo, int *hi)
+{
+    __m128i mn;
+    __m128i mx;
+
+    mn = _mm_xor_si128(v, _mm_set1_epi8((char)0x80));
+    mx = mn;
+    mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 8));
+    mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 8));
+    mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 4));
+    mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 4));
+    mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 2));
+    mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 2));
+    mn = _mm_min_epu8(mn, _mm_srli_si128(mn, 1));
+    mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 1));
+    *lo = (_mm_cvtsi128_si32(mn) & 0xFF) - 0x80;
+    *hi = (_mm_cvtsi128_si32(mx) & 0xFF) - 0x80;
+}
+
+// Aligned 16-byte loads never cross a page, so reading up to the block that
+// holds the NUL is safe, though not to AddressSanitizer. That block is left
+// to the scalar loop.
+__attribute__((no_sanitize_address))
+static size_t   scan_sse2(scan_ctx *x, size_t i)
+{
+    __m128i v;
+    __m128i num;
+    __m128i dig;
+    __m128i open;
+    __m128i close;
+    __m128i d;
+    __m128i vars;
+    int     lo;
+    int     hi;
+
+    vars = _mm_set1_epi8(x->vars ? -1 : 0);
+    while (1)
+    {
+        v = _mm_load_si128((const __m128i *)(x->s + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())))
+            return (i);
+        num = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        dig = _mm_or_si128(num,
+                _mm_and_si128(vars,
+                    _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)),
+                        _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)))));
+        open = _mm_cmpeq_epi8(v, _mm_set1_epi8('('));
+        close = _mm_cmpeq_epi8(v, _mm_set1_epi8(')'));
+        d = _mm_sub_epi8(close, open);
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 1));
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 2));
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+        hminmax(d, &lo, &hi);
+        if (!scan_block(x, i, 16,
+                (uint32_t)_mm_movemask_epi8(_mm_or_si128(dig, close)),
+                (uint32_t)_mm_movemask_epi8(_mm_or_si128(dig, open)),
+                x->numbers ? (uint32_t)_mm_movemask_epi8(num) : 0,
+                (uint32_t)_mm_movemask_epi8(_mm_or_si128(
+                    _mm_or_si128(dig, _mm_or_si128(open, close)),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('+')),
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8('*'))))),
+                lo, hi, (signed char)(_mm_extract_epi16(d, 7) >> 8)))
+            return (i);
+        i += 16;
+    }
+}
+
+// The same with 32 bytes. Byte shifts stay within 128-bit lanes, so the low
+// lane's total is carried into the high lane after the in-lane prefix sum.
+__attribute__((target("avx2"), no_sanitize_address))
+static size_t   scan_avx2(scan_ctx *x, size_t i)
+{
+    __m256i v;
+    __m256i num;
+    __m256i dig;
+    __m256i open;
+    __m256i close;
+    __m256i d;
+    __m256i carry;
+    __m256i vars;
+    int     lo;
+    int     hi;
+    int     lo2;
+    int     hi2;
+
+    vars = _mm256_set1_epi8(x->vars ? -1 : 0);
+    while (1)
+    {
+        v = _mm256_load_si256((const __m256i *)(x->s + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())))
+            return (i);
+        num = _mm256_and_si256(
+                _mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        dig = _mm256_or_si256(num,
+                _mm256_and_si256(vars, _mm256_and_si256(
+                    _mm256_cmpgt_epi8(v, _mm256_set1_epi8('a' - 1)),
+                    _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), v))));
+        open = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('('));
+        close = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')'));
+        d = _mm256_sub_epi8(close, open);
+        d = _mm256_add_epi8(d, _mm256_slli_si256(d, 1));
+        d = _mm256_add_epi8(d, _mm256_slli_si256(d, 2));
+        d = _mm256_add_epi8(d, _mm256_slli_si256(d, 4));
+        d = _mm256_add_epi8(d, _mm256_slli_si256(d, 8));
+        carry = _mm256_shuffle_epi8(d, _mm256_set1_epi8(15));
+        d = _mm256_add_epi8(d, _mm256_permute2x128_si256(carry, carry, 0x08));
+        hminmax(_mm256_castsi256_si128(d), &lo, &hi);
+        hminmax(_mm256_extracti128_si256(d, 1), &lo2, &hi2);
+        lo = lo2 < lo ? lo2 : lo;
+        hi = hi2 > hi ? hi2 : hi;
+        if (!scan_block(x, i, 32,
+                (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(dig, close)),
+                (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(dig, open)),
+                x->numbers ? (uint32_t)_mm256_movemask_epi8(num) : 0,
+                (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+                    _mm256_or_si256(dig, _mm256_or_si256(open, close)),
+                    _mm256_or_si256(
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('+')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('*'))))),
+                lo, hi, (signed char)(_mm256_extract_epi8(d, 31))))
+            return (i);
+        i += 32;
+    }
+}
+
+#endif
+
+void    vbc_scan_input(const char *s, int flags, vbc_scan *sc)
+{
+    scan_ctx    x;
+    size_t      i;
+    size_t      align;
+
+    x.s = s;
+    x.depth = 0;
+    x.max = 0;
+    x.bad = SCAN_NONE;
+    x.close = SCAN_NONE;
+    x.prev_a = 0;
+    x.prev_num = 0;
+    x.vars = (flags & VBC_VARS) != 0;
+    x.numbers = (flags & VBC_NUMBERS) != 0;
+    x.multi = 0;
+    i = 0;
+    align = 1;
+#ifdef SCAN_X86
+    align = __builtin_cpu_supports("avx2") ? 32 : 16;
+#endif
+    while (x.close == SCAN_NONE && s[i] && ((uintptr_t)(s + i) & (align - 1)))
+        scan_byte(&x, i++);
+#ifdef SCAN_X86
+    if (x.close == SCAN_NONE && s[i])
+        i = align == 32 ? scan_avx2(&x, i) : scan_sse2(&x, i);
+#endif
+    while (x.close == SCAN_NONE && s[i])
+        scan_byte(&x, i++);
+    if (x.close != SCAN_NONE)
+    {
+        i = x.close + strlen(s + x.close);
+        x.bad = x.close;
+    }
+    sc->len = i;
+    sc->depth = x.max;
+    if (x.bad == SCAN_NONE && (x.depth || !x.prev_a))
+        x.bad = i;
+    sc->bad = x.bad == SCAN_NONE ? i : x.bad;
+    sc->close = x.close == SCAN_NONE ? i : x.close;
+    sc->valid = x.bad == SCAN_NONE;
+    sc->multi = x.multi;
+}
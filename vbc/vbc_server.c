@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "vbc.h"
+
+// Server mode: one newline-terminated expression per request, one line of
+// output per answer, in the same format as batch mode. Requests are answered
+// as soon as their newline arrives; every complete line in a read is
+// evaluated before the answers are written back together, so a client may
+// pipeline as many requests as it likes. Latency is measured from the read
+// that completed a request to the write that finished sending its answer.
+// A line that reaches SERVER_LINE_MAX bytes without its newline is answered
+// with "Line too long" and ends the connection, so that no client can make
+// the server buffer without limit.
+#define SERVER_MAX_CLIENTS 64
+#define SERVER_READ 65536
+#define SERVER_LINE_MAX (1 << 26)
+
+typedef struct conn {
+    int         in;
+    int         out;
+    char        *rbuf;
+    size_t      rlen;
+    size_t      rcap;
+    char        *wbuf;
+    size_t      wlen;
+    size_t      woff;
+    size_t      wcap;
+    uint64_t    *stamps;    // arrival time of each answer still in wbuf
+    size_t      nstamps;
+    size_t      scap;
+    int         eof;        // the peer has sent everything
+}   conn;
+
+typedef struct server {
+    conn        clients[SERVER_MAX_CLIENTS];
+    size_t      nclients;
+    arena       a;
+    vbc_mode    mode;
+    int         flags;
+    uint64_t    *lat;
+    size_t      nlat;
+    size_t      latcap;
+}   server;
+
+static volatile sig_atomic_t    g_stop;
+
+static void     on_signal(int sig)
+{
+    (void)sig;
+    g_stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+static int      reserve(void **buf, size_t *cap, size_t need, size_t size)
+{
+    void    *tmp;
+    size_t  n;
+
+    if (need <= *cap)
+        return (1);
+    n = *cap ? *cap : 64;
+    while (n < need)
+        n *= 2;
+    tmp = realloc(*buf, n * size);
+    if (!tmp)
+        return (0);
+    *buf = tmp;
+    *cap = n;
+    return (1);
+}
+
+// A NULL line is one that was too long.
+static int      conn_answer(server *sv, conn *c, char *line, uint64_t t)
+{
+    vbc_error   err;
+    int         res;
+    int         n;
+
+    err.code = VBC_OK;
+    if (line)
+        vbc_eval(line, sv->mode, sv->flags, &sv->a, &res, &err);
+    if (err.code == VBC_ENOMEM)
+        return (0);
+    if (!reserve((void **)&c->wbuf, &c->wcap, c->wlen + 32, 1)
+        || !reserve((void **)&c->stamps, &c->scap, c->nstamps + 1,
+            sizeof(*c->stamps)))
+        return (0);
+    if (!line)
+        n = snprintf(c->wbuf + c->wlen, 32, "Line too long");
+    else if (err.code == VBC_OK)
+        n = snprintf(c->wbuf + c->wlen, 32, "%d", res);
+    else
+        n = vbc_strerror(&err, c->wbuf + c->wlen, 32);
+    c->wlen += n;
+    c->wbuf[c->wlen++] = '\n';
+    c->stamps[c->nstamps++] = t;
+    return (1);
+}
+
+// Writes as much of wbuf as the descriptor takes. Once everything queued has
+// gone out, the answers' latencies are recorded. Returns 0 on a write error.
+static int      conn_flush(server *sv, conn *c)
+{
+    ssize_t     w;
+    uint64_t    t;
+    size_t      i;
+
+    while (c->woff < c->wlen)
+    {
+        w = write(c->out, c->wbuf + c->woff, c->wlen - c->woff);
+        if (w < 0 && errno == EINTR)
+            continue ;
+        if (w < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK);
+        c->woff += w;
+    }
+    t = now_ns();
+    if (!reserve((void **)&sv->lat, &sv->latcap, sv->nlat + c->nstamps,
+            sizeof(*sv->lat)))
+        return (0);
+    i = 0;
+    while (i < c->nstamps)
+        sv->lat[sv->nlat++] = t - c->stamps[i++];
+    c->nstamps = 0;
+    c->wlen = 0;
+    c->woff = 0;
+    return (1);
+}
+
+// Reads what is available and answers every complete line. At end of input a
+// last line without a newline is answered too and eof is set; the answers
+// still have to be flushed. Returns 0 on a fatal error.
+static int      conn_read(server *sv, conn *c)
+{
+    ssize_t     r;
+    uint64_t    t;
+    char        *line;
+    char        *nl;
+    size_t      left;
+
+    if (!reserve((void **)&c->rbuf, &c->rcap, c->rlen + SERVER_READ, 1))
+        return (0);
+    r = read(c->in, c->rbuf + c->rlen, SERVER_READ);
+    if (r < 0)
+        return (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK);
+    t = now_ns();
+    if (r == 0)
+    {
+        c->eof = 1;
+        c->rbuf[c->rlen] = '\0';
+        if (!c->rlen)
+            return (1);
+        c->rlen = 0;
+        return (conn_answer(sv, c, c->rbuf, t));
+    }
+    nl = memchr(c->rbuf + c->rlen, '\n', r);
+    c->rlen += r;
+    line = c->rbuf;
+    while (nl)
+    {
+        *nl = '\0';
+        if (!conn_answer(sv, c, line, t))
+            return (0);
+        line = nl + 1;
+        nl = memchr(line, '\n', c->rbuf + c->rlen - line);
+    }
+    left = c->rbuf + c->rlen - line;
+    memmove(c->rbuf, line, left);
+    c->rlen = left;
+    if (left < SERVER_LINE_MAX)
+        return (1);
+    c->rlen = 0;
+    c->eof = 1;
+    return (conn_answer(sv, c, NULL, t));
+}
+
+static void     conn_close(conn *c, int owned)
+{
+    if (owned)
+        close(c->in);
+    free(c->rbuf);
+    free(c->wbuf);
+    free(c->stamps);
+    memset(c, 0, sizeof(*c));
+}
+
+static int      cmp_u64(const void *a, const void *b)
+{
+    uint64_t    x;
+    uint64_t    y;
+
+    x = *(const uint64_t *)a;
+    y = *(const uint64_t *)b;
+    return ((x > y) - (x < y));
+}
+
+static void     report(server *sv)
+{
+    static const double pct[] = {50, 90, 99, 99.9};
+    size_t              i;
+
+    fprintf(stderr, "requests: %zu", sv->nlat);
+    if (sv->nlat)
+    {
+        qsort(sv->lat, sv->nlat, sizeof(*sv->lat), cmp_u64);
+        i = 0;
+        while (i < sizeof(pct) / sizeof(*pct))
+        {
+            fprintf(stderr, ", p%g: %.1fus", pct[i], sv->lat[(size_t)(pct[i]
+                / 100 * (sv->nlat - 1))] / 1e3);
+            i++;
+        }
+        fprintf(stderr, ", max: %.1fus", sv->lat[sv->nlat - 1] / 1e3);
+    }
+    fprintf(stderr, "\n");
+}
+
+// stdin/stdout: a single connection. Answers are flushed with blocking
+// writes before the next read, since the descriptors are not ours to make
+// non-blocking.
+static int      serve_stdio(server *sv)
+{
+    conn    *c;
+    int     ok;
+
+    c = &sv->clients[0];
+    memset(c, 0, sizeof(*c));
+    c->in = 0;
+    c->out = 1;
+    ok = 1;
+    while (ok && !g_stop && !c->eof)
+    {
+        ok = conn_read(sv, c);
+        if (!conn_flush(sv, c))
+            ok = 0;
+    }
+    conn_close(c, 0);
+    return (!ok);
+}
+
+// A stale socket left at path by an earlier run is replaced; any other kind
+// of file is left alone and the server does not start.
+static int      listen_unix(const char *path)
+{
+    struct sockaddr_un  addr;
+    struct stat         st;
+    int                 fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return (-1);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (lstat(path, &st) == 0 && (!S_ISSOCK(st.st_mode) || unlink(path) < 0))
+        return (-1);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return (-1);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || listen(fd, SERVER_MAX_CLIENTS) < 0)
+    {
+        close(fd);
+        return (-1);
+    }
+    return (fd);
+}
+
+static void     serve_accept(server *sv, int lfd)
+{
+    conn    *c;
+    int     fd;
+
+    while (sv->nclients < SERVER_MAX_CLIENTS)
+    {
+        fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return ;
+        c = &sv->clients[sv->nclients++];
+        memset(c, 0, sizeof(*c));
+        c->in = fd;
+        c->out = fd;
+    }
+}
+
+static int      serve_socket(server *sv, const char *path)
+{
+    struct pollfd   pfd[SERVER_MAX_CLIENTS + 1];
+    conn            *c;
+    size_t          i;
+    int             lfd;
+
+    lfd = listen_unix(path);
+    if (lfd < 0)
+        return (1);
+    while (!g_stop)
+    {
+        pfd[0].fd = lfd;
+        pfd[0].events = POLLIN;
+        i = 0;
+        while (i < sv->nclients)
+        {
+            pfd[i + 1].fd = sv->clients[i].in;
+            pfd[i + 1].events = sv->clients[i].woff < sv->clients[i].wlen
+                ? POLLOUT : POLLIN;
+            i++;
+        }
+        if (poll(pfd, sv->nclients + 1, -1) < 0)
+            continue ;
+        i = sv->nclients;
+        while (i-- > 0)
+        {
+            c = &sv->clients[i];
+            if (!pfd[i + 1].revents)
+                continue ;
+            if (((pfd[i + 1].revents & POLLOUT) || conn_read(sv, c))
+                && conn_flush(sv, c) && (!c->eof || c->woff < c->wlen))
+                continue ;
+            conn_close(c, 1);
+            *c = sv->clients[--sv->nclients];
+        }
+        if (pfd[0].revents & POLLIN)
+            serve_accept(sv, lfd);
+    }
+    while (sv->nclients)
+        conn_close(&sv->clients[--sv->nclients], 1);
+    close(lfd);
+    unlink(path);
+    return (0);
+}
+
+// Serves requests on stdin/stdout when path is "-", otherwise on a Unix
+// socket bound at path, until end of input or SIGINT/SIGTERM. The latency
+// percentiles are printed to stderr on the way out.
+int     run_server(const char *path, vbc_mode mode, int flags)
+{
+    struct sigaction    sa;
+    server              *sv;
+    int                 ret;
+
+    sv = calloc(1, sizeof(*sv));
+    if (!sv)
+        return (1);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    arena_init(&sv->a);
+    sv->mode = mode;
+    sv->flags = flags;
+    if (path[0] == '-' && !path[1])
+        ret = serve_stdio(sv);
+    else
+        ret = serve_socket(sv, path);
+    report(sv);
+    arena_release(&sv->a);
+    free(sv->lat);
+    free(sv);
+    return (ret);
+}
@@ -0,0 +1,72 @@
+#include "vbc.h"
+
+// Both operands are the two most recent subtrees, so in a plain arena every
+// node from ml (or mr) up is theirs and can be rewound. A hash-consed arena
+// shares nodes and is never rewound; folded constants are interned instead.
+static node *keep(const vbc_build *b, node *n, arena_mark drop)
+{
+    if (!b->dag)
+        arena_rewind(b->a, drop);
+    return (n);
+}
+
+static node *constant(const vbc_build *b, int v, arena_mark from)
+{
+    node    tmp;
+
+    tmp.type = VAL;
+    tmp.val = v;
+    tmp.l = NULL;
+    tmp.r = NULL;
+    if (!b->dag)
+        arena_rewind(b->a, from);
+    return (vbc_make(b, tmp));
+}
+
+// Keeps r in place of the constant l, the lone node of the left operand. When
+// r is the last node made, it moves into l's slot and its own is given back;
+// when it is not, having been moved there itself, l is left unused.
+static node *hoist(const vbc_build *b, node *l, node *r)
+{
+    arena_mark  top;
+
+    if (b->dag)
+        return (r);
+    top = arena_get_mark(b->a);
+    if (!top.used || &top.b->nodes[top.used - 1] != r)
+        return (r);
+    *l = *r;
+    top.used--;
+    top.nodes--;
+    arena_rewind(b->a, top);
+    return (l);
+}
+
+static int  is_val(const node *n, int v)
+{
+    return (n->type == VAL && n->val == v);
+}
+
+node    *simplify(const vbc_build *b, node n, arena_mark ml, arena_mark mr)
+{
+    unsigned int    v;
+
+    if (n.l->type == VAL && n.r->type == VAL)
+    {
+        v = n.type == ADD ? (unsigned int)n.l->val + (unsigned int)n.r->val
+            : (unsigned int)n.l->val * (unsigned int)n.r->val;
+        if (b->dag)
+            return (constant(b, (int)v, ml));
+        n.l->val = (int)v;
+        return (keep(b, n.l, mr));
+    }
+    if (n.type == MULTI && is_val(n.r, 0))
+        return (constant(b, 0, ml));
+    if ((n.type == MULTI && is_val(n.l, 0))
+        || (n.type == MULTI && is_val(n.r, 1))
+        || (n.type == ADD && is_val(n.r, 0)))
+        return (keep(b, n.l, mr));
+    if ((n.type == MULTI && is_val(n.l, 1)) || (n.type == ADD && is_val(n.l, 0)))
+        return (hoist(b, n.l, n.r));
+    return (vbc_make(b, n));
+}